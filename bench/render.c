@@ -0,0 +1,195 @@
+/*
+ * Headless renderer benchmark: drives ui_draw() over a few window layouts
+ * and message streams, with the output going to memory instead of a
+ * terminal, and reports frames per second, bytes per frame and frame times.
+ *
+ * usage: bench/render [frames]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "eria.h"
+#include "buffer.h"
+#include "window.h"
+#include "input.h"
+#include "alloc.h"
+#include "util.h"
+#include "ui.h"
+
+#define ROWS    50
+#define COLS    200
+#define BUFFERS 8
+#define BACKLOG 500
+
+static char const *words[] = {
+        "the", "build", "is", "broken", "again", "https://example.com/log",
+        "segfault", "in", "term_flush()", "ok", "¯\\_(ツ)_/¯", "日本語", "lgtm",
+        "\002bold\002", "\00304red\003", "\035italic\035",
+};
+
+static char const *nicks[] = { "alice", "bob", "carol", "dave", "eve", "mallory" };
+
+static struct {
+        char const *name;
+        int windows;
+        int messages; /* per frame */
+        bool typing;
+} const scenarios[] = {
+        { "1 typing",  1, 0,  true  },
+        { "1 trickle", 1, 1,  false },
+        { "1 flood",   1, 20, false },
+        { "4 trickle", 4, 1,  true  },
+        { "4 flood",   4, 20, true  },
+        { "8 flood",   8, 20, true  },
+};
+
+/* the memory "terminal" */
+static size_t sunk;
+
+static ssize_t
+sink(void *ctx, void const *data, size_t n)
+{
+        (void)ctx;
+        (void)data;
+        sunk += n;
+        return n;
+}
+
+static double
+now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+by_value(void const *a, void const *b)
+{
+        double x = *(double const *)a;
+        double y = *(double const *)b;
+        return (x > y) - (x < y);
+}
+
+static Message *
+chatter(unsigned *seed)
+{
+        char body[512];
+        int n = 0;
+
+        for (int j = 0, k = 1 + rand_r(seed) % 30; j < k; ++j)
+                n += snprintf(body + n, sizeof body - n, "%s ", words[rand_r(seed) % COUNTOF(words)]);
+
+        char const *nick = nicks[rand_r(seed) % COUNTOF(nicks)];
+
+        return msg("^%^", "%", ui_nick_color(nick), nick, body);
+}
+
+/* split the focused window until there are `n` of them, alternating directions */
+static void
+layout(Eria *state, Buffer **buffers, int n)
+{
+        Window *w = state->root;
+        w->buffer = buffers[0];
+
+        for (int i = 1; i < n; ++i) {
+                if (i & 1)
+                        window_vsplit(w, buffers[i], -1);
+                else
+                        window_hsplit(w, buffers[i], -1);
+                w = w->two;
+        }
+
+        state->window = w;
+}
+
+int
+main(int argc, char **argv)
+{
+        int frames = (argc > 1) ? atoi(argv[1]) : 2000;
+
+        /* keep buffer_new() from opening logs */
+        setenv("HOME", "/nonexistent", 1);
+
+        static Config config = { .colors = 1 << 24 };
+        static Eria state = { .config = &config, .redraw_timeout = -1 };
+
+        Network *network = alloc(sizeof *network);
+        network->name = "bench";
+        network->connection = irc_init();
+        network->nick_regex = NULL;
+        network->status = NET_ONLINE;
+        network->lag = -1;
+        irc_set_nick(network->connection, "eria");
+        vec_init(network->buffers);
+        state.networks.items[state.networks.count++] = network;
+
+        double *times = alloc(frames * sizeof *times);
+
+        printf("%dx%d, %d frames each\n", COLS, ROWS, frames);
+        printf("%-10s %10s %12s %10s %10s\n", "", "frames/s", "bytes/frame", "p50", "p99");
+
+        for (int s = 0; s < COUNTOF(scenarios); ++s) {
+                unsigned seed = s + 1;
+
+                ui_init_sink(&state, ROWS, COLS, sink, NULL);
+
+                Buffer *buffers[BUFFERS];
+                network->buffers.count = 0;
+                for (int i = 0; i < BUFFERS; ++i) {
+                        char name[32];
+                        snprintf(name, sizeof name, "#bench%d", i);
+                        buffers[i] = buffer_new(name, network, B_CHANNEL);
+                        vec_push(network->buffers, buffers[i]);
+                        for (int j = 0; j < BACKLOG; ++j)
+                                buffer_add(buffers[i], &state, chatter(&seed));
+                }
+
+                layout(&state, buffers, scenarios[s].windows);
+
+                /* the first frame paints everything, so it isn't counted */
+                ui_draw(&state);
+                sunk = 0;
+
+                double start = now();
+
+                for (int f = 0; f < frames; ++f) {
+                        for (int m = 0; m < scenarios[s].messages; ++m) {
+                                Buffer *b = buffers[rand_r(&seed) % scenarios[s].windows];
+                                buffer_add(b, &state, chatter(&seed));
+                        }
+
+                        if (scenarios[s].typing)
+                                handle_text(&state, (char[]){ 'a' + f % 26, '\0' });
+                        if (scenarios[s].typing && f % 40 == 39) {
+                                handle_key(&state, "C-a");
+                                handle_key(&state, "C-k");
+                        }
+
+                        double t0 = now();
+                        ui_draw(&state);
+                        times[f] = now() - t0;
+                }
+
+                double elapsed = now() - start;
+
+                qsort(times, frames, sizeof *times, by_value);
+
+                printf(
+                        "%-10s %10.0f %12.0f %8.1fus %8.1fus\n",
+                        scenarios[s].name,
+                        frames / elapsed,
+                        (double)sunk / frames,
+                        times[frames / 2] * 1e6,
+                        times[frames * 99 / 100] * 1e6
+                );
+        }
+
+        return 0;
+}
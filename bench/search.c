@@ -0,0 +1,95 @@
+/*
+ * search_icase() vs. glibc's strcasestr() over a channel log.
+ *
+ * usage: bench/search ~/.eria/logs/<network>.<channel> [query...]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "vec.h"
+#include "util.h"
+#include "search.h"
+
+#define ROUNDS 50
+
+static double
+now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+        static char const *defaults[] = { "the", "http", "ERIA", "segfault", "xyzzy", NULL };
+
+        if (argc < 2) {
+                fprintf(stderr, "usage: %s <log> [query...]\n", argv[0]);
+                return 1;
+        }
+
+        size_t size;
+        char *log = slurp(argv[1], &size);
+
+        vec(char *) lines;
+        vec(size_t) lengths;
+        vec_init(lines);
+        vec_init(lengths);
+
+        /* keep only the message body: "<time>\t<title>\t<body>" */
+        for (char *line = strtok(log, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+                char *body = strrchr(line, '\t');
+                body = (body == NULL) ? line : body + 1;
+                vec_push(lines, body);
+                vec_push(lengths, strlen(body));
+        }
+
+        char const **queries = (argc > 2) ? (char const **)argv + 2 : defaults;
+
+        printf("%zu lines, %zu bytes\n", lines.count, size);
+        printf("%-12s %8s %12s %12s %8s\n", "query", "hits", "strcasestr", "search", "speedup");
+
+        for (; *queries != NULL; ++queries) {
+                char const *q = *queries;
+                size_t qn = strlen(q);
+                size_t hits = 0;
+                size_t mismatches = 0;
+
+                for (size_t i = 0; i < lines.count; ++i) {
+                        char const *a = strcasestr(lines.items[i], q);
+                        char const *b = search_icase(lines.items[i], lengths.items[i], q, qn);
+                        hits += (a != NULL);
+                        mismatches += (a != b);
+                }
+
+                volatile size_t sink = 0;
+
+                double t0 = now();
+                for (int r = 0; r < ROUNDS; ++r)
+                        for (size_t i = 0; i < lines.count; ++i)
+                                sink += strcasestr(lines.items[i], q) != NULL;
+                double t1 = now();
+                for (int r = 0; r < ROUNDS; ++r)
+                        for (size_t i = 0; i < lines.count; ++i)
+                                sink += search_icase(lines.items[i], lengths.items[i], q, qn) != NULL;
+                double t2 = now();
+
+                double libc = (t1 - t0) / ROUNDS * 1e3;
+                double ours = (t2 - t1) / ROUNDS * 1e3;
+
+                printf("%-12s %8zu %10.3fms %10.3fms %7.2fx", q, hits, libc, ours, libc / ours);
+                if (mismatches != 0)
+                        printf("  (%zu mismatches!)", mismatches);
+                putchar('\n');
+        }
+
+        return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * Keypress-to-bytes-written latency: types into one of several windows
+ * full of scrollback, with traffic arriving in the others, and times each
+ * key from handle_text()/handle_key() until ui_draw()'s output has been
+ * written to the terminal. The terminal is a pseudo-terminal that a thread
+ * reads and throws away.
+ *
+ * usage: bench/typing [keys]
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "eria.h"
+#include "buffer.h"
+#include "window.h"
+#include "input.h"
+#include "alloc.h"
+#include "util.h"
+#include "panic.h"
+#include "ui.h"
+
+#define ROWS     50
+#define COLS     200
+#define WINDOWS  4
+#define BACKLOG  2000
+#define LINE     40
+
+static char const *words[] = {
+        "the", "build", "is", "broken", "again", "https://example.com/log",
+        "segfault", "in", "term_flush()", "ok", "¯\\_(ツ)_/¯", "日本語", "lgtm",
+};
+
+static double
+now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+by_value(void const *a, void const *b)
+{
+        double x = *(double const *)a;
+        double y = *(double const *)b;
+        return (x > y) - (x < y);
+}
+
+static void *
+reader(void *arg)
+{
+        int fd = *(int *)arg;
+        char buf[1 << 16];
+
+        while (read(fd, buf, sizeof buf) > 0)
+                ;
+
+        return NULL;
+}
+
+static Message *
+chatter(int i)
+{
+        char body[256];
+        int n = 0;
+
+        for (int j = 0, k = 3 + i % 17; j < k; ++j)
+                n += snprintf(body + n, sizeof body - n, "%s ", words[(i * 7 + j * 3) % COUNTOF(words)]);
+
+        return msg("%", "%", i & 1 ? "alice" : "bob", body);
+}
+
+/* one key: either text or a named key */
+static void
+key(Eria *state, int i)
+{
+        if (i % LINE == LINE - 2)
+                handle_key(state, "C-a");
+        else if (i % LINE == LINE - 1)
+                handle_key(state, "C-k");
+        else
+                handle_text(state, (char[]){ 'a' + i % 26, '\0' });
+}
+
+/* draw, then wait for the terminal to take all of it */
+static void
+draw(Eria *state)
+{
+        while (!ui_draw(state)) {
+                struct pollfd out = { .fd = ui_output_fd(), .events = POLLOUT };
+                poll(&out, 1, -1);
+                ui_drain();
+        }
+
+        for (int fd; (fd = ui_output_fd()) != -1; ) {
+                struct pollfd out = { .fd = fd, .events = POLLOUT };
+                poll(&out, 1, -1);
+                ui_drain();
+        }
+}
+
+static void
+report(FILE *out, char const *name, double *t, int n)
+{
+        double sum = 0;
+
+        for (int i = 0; i < n; ++i)
+                sum += t[i];
+
+        qsort(t, n, sizeof *t, by_value);
+
+        fprintf(
+                out,
+                "%-10s %9.1fus %9.1fus %9.1fus %9.1fus\n",
+                name,
+                sum / n * 1e6,
+                t[n / 2] * 1e6,
+                t[n * 99 / 100] * 1e6,
+                t[n - 1] * 1e6
+        );
+}
+
+int
+main(int argc, char **argv)
+{
+        int keys = (argc > 1) ? atoi(argv[1]) : 5000;
+
+        int master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1)
+                epanic("couldn't open a pseudo-terminal");
+
+        int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+        if (slave == -1)
+                epanic("couldn't open %s", ptsname(master));
+
+        struct winsize ws = { .ws_row = ROWS, .ws_col = COLS };
+        ioctl(slave, TIOCSWINSZ, &ws);
+
+        pthread_t thread;
+        pthread_create(&thread, NULL, reader, &master);
+
+        /* the frames go to the pseudo-terminal, the results to where stdout was */
+        FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        fcntl(STDOUT_FILENO, F_SETFL, fcntl(STDOUT_FILENO, F_GETFL) | O_NONBLOCK);
+
+        /* keep buffer_new() from opening logs */
+        setenv("HOME", "/nonexistent", 1);
+
+        static Config config = { .colors = 1 << 24 };
+        static Eria state = { .config = &config, .redraw_timeout = -1 };
+
+        Network *network = alloc(sizeof *network);
+        network->name = "bench";
+        network->connection = irc_init();
+        network->nick_regex = NULL;
+        network->status = NET_ONLINE;
+        network->lag = -1;
+        irc_set_nick(network->connection, "eria");
+        vec_init(network->buffers);
+        state.networks.items[state.networks.count++] = network;
+
+        ui_init(&state);
+
+        Buffer *buffers[WINDOWS];
+        for (int i = 0; i < WINDOWS; ++i) {
+                char name[32];
+                snprintf(name, sizeof name, "#bench%d", i);
+                buffers[i] = buffer_new(name, network, B_CHANNEL);
+                vec_push(network->buffers, buffers[i]);
+                for (int j = 0; j < BACKLOG; ++j)
+                        buffer_add(buffers[i], &state, chatter(i * BACKLOG + j));
+        }
+
+        /* four windows in a square, typing into the top left one */
+        state.root->buffer = buffers[0];
+        window_vsplit(state.root, buffers[1], -1);
+        window_hsplit(state.root->left, buffers[2], -1);
+        window_hsplit(state.root->right, buffers[3], -1);
+        state.window = state.root->left->top;
+
+        draw(&state);
+
+        double *quiet = alloc(keys * sizeof *quiet);
+        double *busy = alloc(keys * sizeof *busy);
+        double *full = alloc(keys * sizeof *full);
+
+        for (int i = 0; i < keys; ++i) {
+                double t0 = now();
+                key(&state, i);
+                draw(&state);
+                quiet[i] = now() - t0;
+        }
+
+        for (int i = 0; i < keys; ++i) {
+                /* a message lands in another window and is drawn before the next key */
+                buffer_add(buffers[1 + i % (WINDOWS - 1)], &state, chatter(i));
+                draw(&state);
+
+                double t0 = now();
+                key(&state, i);
+                draw(&state);
+                busy[i] = now() - t0;
+        }
+
+        /* for comparison: keys that have the whole screen redrawn and repainted, as after a resize */
+        for (int i = 0; i < keys; ++i) {
+                ui_resize();
+                double t0 = now();
+                key(&state, i);
+                draw(&state);
+                full[i] = now() - t0;
+        }
+
+        fprintf(out, "%dx%d, %d windows, %d keys\n", COLS, ROWS, WINDOWS, keys);
+        fprintf(out, "%-10s %11s %11s %11s %11s\n", "", "mean", "p50", "p99", "max");
+        report(out, "quiet", quiet, keys);
+        report(out, "busy", busy, keys);
+        report(out, "full", full, keys);
+
+        return 0;
+}
@@ -7,6 +7,7 @@
 #include "network.h"
 #include "message.h"
 #include "tsmap.h"
+#include "loop.h"
 
 struct eria;
 typedef struct eria Eria;
@@ -30,6 +31,9 @@ typedef struct buffer {
 
         FILE *log;
 
+        Timer *idle;
+        bool asleep; /* idle for long enough that its log was closed */
+
         TSMap *tsm;
         bool complete_again;
 } Buffer;
@@ -4,7 +4,6 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <libsrsirc/irc.h>
-#include <poll.h>
 #include <termkey.h>
 #include <time.h>
 #include "vec.h"
@@ -24,7 +23,10 @@ typedef struct {
         char const *nick;
         char const *user;
         char const *real;
-        
+
+        /* how to read lines that aren't UTF-8: "cp1252" (the default) or "latin1" */
+        char const *encoding;
+
         struct {
                 char const *mechanism;
                 char const *key;
@@ -38,11 +40,11 @@ typedef struct {
         NetworkConfig networks[ERIA_MAX_NETWORKS + 1];
         intmax_t room_list_timeout;
         char const *quit_message;
+        int colors; /* 16, 256 or 1 << 24; 0 guesses from $COLORTERM and $TERM */
 } Config;
 
 typedef struct eria {
         Config *config;
-        struct pollfd fds[1 + ERIA_MAX_NETWORKS];
         TermKey *tk;
         struct {
                 Network *items[ERIA_MAX_NETWORKS];
@@ -50,8 +52,14 @@ typedef struct eria {
         } networks;
         Window *window;
         Window *root;
-        intmax_t redraw_timeout;
+        intmax_t redraw_timeout; /* set to show the room list for that many ms */
         bool draw_rooms;
+
+        /* ms from the start of main() until each happened, -1 until it has */
+        struct {
+                intmax_t usable; /* the first frame was drawn, and keys are being read */
+                intmax_t joined; /* every network is connected, and in all of its channels */
+        } startup;
 } Eria;
 
 Message *
@@ -0,0 +1,49 @@
+#ifndef GSEARCH_H_INCLUDED
+#define GSEARCH_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "eria.h"
+#include "buffer.h"
+#include "search.h"
+
+/*
+ * Search across every buffer on every network. The work is split into one
+ * shard per buffer and run on a small pool of worker threads; results are
+ * handed back to the UI thread, which picks them up with gsearch_collect()
+ * whenever gsearch_fd() becomes readable.
+ */
+
+typedef struct {
+        Buffer *buffer;
+        Message *message;
+        int distance;
+} Result;
+
+/* start a new search, unless `text` is the query that's already running */
+void
+gsearch_update(Eria *state, char const *text, size_t n);
+
+void
+gsearch_cancel(void);
+
+/* readable when there are new results for gsearch_collect() */
+int
+gsearch_fd(void);
+
+/* returns true if any new results came in */
+bool
+gsearch_collect(void);
+
+/* results so far, closest first and then newest first */
+Result const *
+gsearch_results(size_t *n);
+
+Query const *
+gsearch_query(void);
+
+bool
+gsearch_busy(void);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef INGEST_H_INCLUDED
+#define INGEST_H_INCLUDED
+
+#include <stdbool.h>
+#include <libsrsirc/irc.h>
+
+#include "network.h"
+#include "buffer.h"
+#include "message.h"
+
+/*
+ * Each network's connection is read on a thread of its own: the thread
+ * waits on the socket, reads and tokenizes lines, lets libsrsirc track
+ * them and turns them into Events, which go to the UI thread through a
+ * bounded single-producer, single-consumer ring. The UI thread picks them
+ * up with ingest_pop() when ingest_fd() becomes readable.
+ *
+ * The connection (including what libsrsirc tracks) and the list of
+ * buffers are shared, and guarded by the network's lock. The thread takes
+ * it for each line; the UI thread holds every network's lock except while
+ * it's waiting for something to happen.
+ */
+
+typedef struct {
+        enum {
+                EV_MESSAGE, /* add `message` to `buffer` */
+                EV_JOINED,  /* every channel asked for on connecting has been joined or refused */
+                EV_FOCUS,   /* show `buffer`, which we've just joined for the first time */
+                EV_PONG,    /* the answer to a PING */
+                EV_DEAD,    /* the connection was lost */
+                EV_CONNECTED, /* ingest_connect() worked, and the network has a new connection */
+                EV_FAILED,    /* it didn't */
+        } type;
+        Buffer *buffer;
+        Message *message;
+        bool activity; /* whether it counts as activity in `buffer`, as a PRIVMSG does */
+        bool bell;
+        char nick[64]; /* who to move up in nick completion, if anyone */
+} Event;
+
+/* called on the network's thread, with its lock held, for each line */
+typedef void IngestHandler(Network *network, tokarr tokens);
+
+void
+ingest_start(Network *network, IngestHandler *fn);
+
+/* from the network's thread; events that don't fit are held back, and no more is read until they do */
+void
+ingest_push(Network *network, Event const *e);
+
+/* readable when there may be events; ingest_pop() until there aren't */
+int
+ingest_fd(Network const *network);
+
+bool
+ingest_pop(Network *network, Event *e);
+
+/* have the network's thread look at the connection again, after a reset */
+void
+ingest_wake(Network *network);
+
+/*
+ * Have the network's thread connect `connection`, a fresh one, while the
+ * old one stays in place for the UI to look at. Resolving the server,
+ * connecting and registering all happen there, without the lock; if it
+ * works, it takes the old one's place, which is disposed of.
+ */
+void
+ingest_connect(Network *network, irc *connection);
+
+#endif
@@ -1,10 +1,14 @@
 #ifndef INPUT_H_INCLUDED
 #define INPUT_H_INCLUDED
 
-int
+void
 handle_key(Eria *state, char const *s);
 
-int
+void
 handle_text(Eria *state, char const *s);
 
+/* says goodbye to every network, puts the terminal back and exits */
+void
+quit(Eria *state, char const *msg);
+
 #endif
@@ -0,0 +1,75 @@
+#ifndef LOOP_H_INCLUDED
+#define LOOP_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * The event loop. File descriptors, timers and signals are registered once,
+ * each with a handler, and loop_wait() calls the handlers of whatever is
+ * ready, so waiting costs the same however many connections there are.
+ *
+ * On Linux this is epoll, with a signalfd for the signals; elsewhere it's
+ * poll() over a list that's kept up to date as things are registered, with
+ * signals coming in through a pipe. Either way, timers are kept in a timer
+ * wheel (see wheel.h) and the next one due decides how long to wait, so
+ * arming and disarming them is cheap enough to do on every message.
+ */
+
+enum {
+        LOOP_IN  = 1 << 0,
+        LOOP_OUT = 1 << 1,
+};
+
+/* `events` is what's ready; errors and hangups come as everything that was asked for */
+typedef void LoopHandler(void *ctx, int events);
+
+typedef struct timer Timer;
+
+/* before anything else here */
+void
+loop_init(void);
+
+/* watch `fd` for `events`, or change what it's watched for and by whom */
+void
+loop_watch(int fd, int events, LoopHandler *fn, void *ctx);
+
+/* stop watching `fd`, which may already have been closed */
+void
+loop_unwatch(int fd);
+
+Timer *
+loop_timer(LoopHandler *fn, void *ctx);
+
+/* fire once, `ms` milliseconds from now, instead of whenever it was going to */
+void
+loop_arm(Timer *t, intmax_t ms);
+
+void
+loop_disarm(Timer *t);
+
+bool
+loop_armed(Timer const *t);
+
+/*
+ * Handle `signo` in the loop rather than asynchronously. On Linux it's
+ * blocked, so this has to happen before any threads are started.
+ */
+void
+loop_signal(int signo, LoopHandler *fn, void *ctx);
+
+/* milliseconds on the monotonic clock */
+intmax_t
+loop_now(void);
+
+typedef void LoopHook(void *ctx);
+
+/* have `before` and `after` called on either side of each wait, when nothing here is running */
+void
+loop_around_wait(LoopHook *before, LoopHook *after, void *ctx);
+
+/* wait until something is ready, then handle everything that is */
+void
+loop_wait(void);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef MSG_H_INCLUDED
 #define MSG_H_INCLUDED
 
+#include <stdio.h>
 #include <time.h>
 #include <stdbool.h>
 
@@ -20,4 +21,8 @@ msg(char const *tfmt, char const *bfmt, ...);
 void
 msg_log(Message const *m, FILE *f);
 
+/* < 0 if `a` is older than `b`, > 0 if it's newer */
+int
+msg_time_cmp(Message const *a, Message const *b);
+
 #endif
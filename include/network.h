@@ -1,18 +1,34 @@
 #ifndef NETWORK_H_INCLUDED
 #define NETWORK_H_INCLUDED
 
+#include <pthread.h>
 #include <libsrsirc/irc.h>
 #include "vec.h"
 #include "re.h"
+#include "loop.h"
 
 struct buffer;
 typedef struct buffer Buffer;
 
+struct ingest;
+
 typedef struct network {
         char const *name;
         irc *connection;
+        enum { NET_OFFLINE, NET_CONNECTING, NET_ONLINE } status;
         re_pat *nick_regex;
+        Timer *reconnect;
+        Timer *keepalive; /* PINGs the server when it's been quiet, then gives up on it */
+        intmax_t backoff; /* about how long to wait before the next attempt to reconnect, in ms */
+        intmax_t ping_sent; /* loop_now() when the PING we're waiting on went out, or -1 */
+        intmax_t lag; /* ms the server took to answer the last PING, -1 if it hasn't */
+        vec(char *) joining; /* channels asked for on connecting that haven't been joined or refused yet */
         vec(Buffer *) buffers;
+        enum { ENC_CP1252, ENC_LATIN1 } fallback; /* for lines that aren't UTF-8 */
+
+        /* guards the connection and `buffers` from the thread that reads it (see ingest.h) */
+        pthread_mutex_t lock;
+        struct ingest *ingest;
 } Network;
 
 #endif
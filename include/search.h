@@ -0,0 +1,75 @@
+#ifndef SEARCH_H_INCLUDED
+#define SEARCH_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <stdint.h>
+
+#include "vec.h"
+#include "re.h"
+#include "message.h"
+
+/* a fuzzy match is never further off than the pattern is long, which is at most 64 */
+#define QUERY_DISTANCES 65
+
+/*
+ * A window's search query: plain text is matched case-insensitively,
+ * a query of the form /pattern/ is compiled with re_compile(), and
+ * ~text matches with up to one error per leading tilde.
+ */
+typedef struct {
+        vec(char) text;
+        re_pat *re;
+        bool regex;
+        bool bad;
+
+        /* fuzzy queries: allowed errors, pattern length, and match masks */
+        int fuzzy;
+        int m;
+        uint64_t peq[256];
+
+        /* fuzzy queries: the indices of the messages of `source` that match, oldest first, by distance */
+        vec(size_t) hits[QUERY_DISTANCES];
+        size_t ranked; /* how many there are in all */
+        void const *source;
+        size_t scanned;
+} Query;
+
+/*
+ * Case-insensitive (ASCII) substring search. Returns a pointer to the
+ * first occurrence of `needle` in `s`, or NULL if there isn't one.
+ */
+char const *
+search_icase(char const *s, size_t n, char const *needle, size_t m);
+
+void
+query_init(Query *q);
+
+/* returns true if the query changed (and was recompiled) */
+bool
+query_set(Query *q, char const *s, size_t n);
+
+bool
+query_match(Query const *q, char const *s, struct re_result *r);
+
+/* like query_match(), but returns the edit distance of the match, or -1 */
+int
+query_distance(Query const *q, char const *s, struct re_result *r);
+
+/* the better of the distances of a message's body and title, or -1 */
+int
+query_message(Query const *q, Message const *m);
+
+/* rank messages[0..count) of `source` by edit distance, then recency, into q->hits */
+void
+query_rank(Query *q, void const *source, Message *const *messages, size_t count);
+
+/* the index of the message ranked `i`th by query_rank(), from 0, which is less than q->ranked */
+size_t
+query_hit(Query const *q, size_t i);
+
+void
+query_free(Query *q);
+
+#endif
@@ -4,6 +4,7 @@
 #include <inttypes.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <sys/types.h>
 #include "vec.h"
 
 typedef struct {
@@ -21,21 +22,58 @@ typedef struct {
         unsigned italic    : 1;
 } Video;
 
+/*
+ * Glyphs and Videos are interned by the Term, so that a cell is 8 bytes
+ * which can be compared with memcmp(). An all-zero cell is empty.
+ */
 typedef struct {
-        Video video;
-        char data[16];
+        uint32_t glyph; /* an ASCII byte, or 128 + index into the glyph table */
+        uint16_t style; /* index into the style table */
+        uint8_t width;
+        uint8_t unused; /* keeps the struct free of padding */
 } Cell;
 
+struct intern;
+
+/*
+ * What term_write() has done to one row of the current frame, relative to
+ * the frame on screen: [lo, hi) covers every cell written with something
+ * new, and `same` counts the non-empty cells that match the screen.
+ */
+typedef struct {
+        int lo;
+        int hi;
+        int same;
+} Dirty;
+
+/* where rendered output goes; returns like write(2), so -1 with EAGAIN means "not now" */
+typedef ssize_t TermSink(void *ctx, void const *data, size_t n);
+
+/*
+ * buffers[0] is the frame being drawn and buffers[1] is what's on the
+ * screen. After term_flush() the two are the same, so a caller only has to
+ * redraw what changed, after erasing it with term_erase() (or everything,
+ * after term_clear()).
+ */
 typedef struct {
         int rows;
         int cols;
         int y;
         int x;
-        unsigned i : 1;
         bool force;
         Cell *buffers[2];
+        int *ink[2]; /* non-empty cells per row */
+        Dirty *dirty;
+        struct intern *intern;
+        struct { int y; int x; } cursor; /* the terminal's, -1 if unknown */
+        struct { int y; int x; int height; int width; } clip; /* term_write() stays inside this */
+        enum { TC_TRUE, TC_256, TC_16 } colors;
         Video video;
+        bool synced; /* whether the terminal is known to be using `video` */
         vec(char) buffer;
+        size_t written; /* how much of buffer the terminal has taken so far */
+        TermSink *sink; /* NULL writes to stdout */
+        void *sink_ctx;
 } Term;
 
 #define C_DEFAULT ((Color){ 1, 1, 1 })
@@ -62,7 +100,26 @@ term_mvprintf(Term *t, int y, int x, Video v, char const *fmt, ...);
 void
 term_clear(Term *t);
 
+void
+term_erase(Term *t, int y, int x, int height, int width);
+
+void
+term_clip(Term *t, int y, int x, int height, int width);
+
+/* one of TC_TRUE, TC_256 and TC_16, from $COLORTERM and $TERM */
+int
+term_guess_colors(void);
+
+/* render the frame, and write as much of it as the terminal will take right now */
 void
 term_flush(Term *t);
 
+/* write more of what's pending; true once all of it has been written */
+bool
+term_drain(Term *t);
+
+/* is output from an earlier frame still waiting for the terminal? */
+bool
+term_busy(Term const *t);
+
 #endif
@@ -11,12 +11,28 @@
 #define C_JOIN_TEXT ((Color) { 170, 227, 120 })
 #define C_QUIT_TEXT ((Color) { 224, 141, 145 })
 
-void
+/* returns false if the frame was skipped because the terminal is behind */
+bool
 ui_draw(Eria *state);
 
 void
 ui_init(Eria *state);
 
+/* like ui_init(), but frames of the given size go to `sink` and the terminal is left alone */
+void
+ui_init_sink(Eria *state, int rows, int cols, TermSink *sink, void *ctx);
+
+/* take on the terminal's new size; the next frame is drawn from scratch */
+void
+ui_resize(void);
+
+/* the terminal's fd to poll for POLLOUT, or -1 if there's no output waiting */
+int
+ui_output_fd(void);
+
+void
+ui_drain(void);
+
 Color
 ui_nick_color(char const *nick);
 
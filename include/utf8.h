@@ -4,10 +4,18 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <limits.h>
 
 #include "unicode.h"
 #include "log.h"
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 inline static int
 next_utf8(const char *str, int len, uint32_t *cp)
 {
@@ -51,31 +59,283 @@ next_utf8(const char *str, int len, uint32_t *cp)
         return nbytes;
 }
 
+/*
+ * The number of bytes at the start of `str` that are printable ASCII, so
+ * also the number of columns they take up. Most text is mostly this.
+ */
+inline static int
+utf8_ascii(char const *str, int len)
+{
+        unsigned char const *s = (unsigned char const *)str;
+        int n = 0;
+
+#if defined(__AVX2__)
+        for (; n + 32 <= len; n += 32) {
+                __m256i v = _mm256_loadu_si256((__m256i const *)(s + n));
+                /* signed, so anything from 0x80 up is below 0x20 too */
+                __m256i ok = _mm256_and_si256(
+                        _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x1f)),
+                        _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7f), v)
+                );
+                uint32_t bad = ~(uint32_t)_mm256_movemask_epi8(ok);
+                if (bad != 0)
+                        return n + __builtin_ctz(bad);
+        }
+#endif
+#if defined(__SSE2__)
+        for (; n + 16 <= len; n += 16) {
+                __m128i v = _mm_loadu_si128((__m128i const *)(s + n));
+                __m128i ok = _mm_and_si128(
+                        _mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+                        _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f))
+                );
+                unsigned bad = ~_mm_movemask_epi8(ok) & 0xffff;
+                if (bad != 0)
+                        return n + __builtin_ctz(bad);
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        for (; n + 16 <= len; n += 16) {
+                uint8x16_t v = vld1q_u8(s + n);
+                uint8x16_t ok = vandq_u8(vcgeq_u8(v, vdupq_n_u8(0x20)), vcltq_u8(v, vdupq_n_u8(0x7f)));
+                if (vminvq_u8(ok) != 0xff)
+                        break;
+        }
+#endif
+        while (n < len && s[n] >= 0x20 && s[n] < 0x7f)
+                ++n;
+
+        return n;
+}
+
+/* whether `str` is well-formed UTF-8: no overlong forms, surrogates or code points past U+10FFFF */
 inline static bool
 utf8_valid(char const *str, int len)
 {
-        uint32_t cp;
+        unsigned char const *s = (unsigned char const *)str;
+        int i = 0;
 
-        while (len != 0) {
-                int n = next_utf8(str, len, &cp);
-                if (n == -1)
+        while (i < len) {
+                /* nearly everything is ASCII, so skip over it a block at a time */
+#if defined(__AVX2__)
+                while (i + 32 <= len && _mm256_movemask_epi8(_mm256_loadu_si256((__m256i const *)(s + i))) == 0)
+                        i += 32;
+#endif
+#if defined(__SSE2__)
+                while (i + 16 <= len && _mm_movemask_epi8(_mm_loadu_si128((__m128i const *)(s + i))) == 0)
+                        i += 16;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+                while (i + 16 <= len && vmaxvq_u8(vld1q_u8(s + i)) < 0x80)
+                        i += 16;
+#endif
+                if (i == len)
+                        break;
+
+                unsigned char c = s[i];
+                if (c < 0x80) {
+                        i += 1;
+                        continue;
+                }
+
+                /* the range the second byte has to be in depends on the first */
+                unsigned char lo = 0x80;
+                unsigned char hi = 0xbf;
+                int n;
+
+                if (c >= 0xc2 && c <= 0xdf) {
+                        n = 1;
+                } else if (c >= 0xe0 && c <= 0xef) {
+                        n = 2;
+                        if (c == 0xe0) lo = 0xa0;
+                        if (c == 0xed) hi = 0x9f;
+                } else if (c >= 0xf0 && c <= 0xf4) {
+                        n = 3;
+                        if (c == 0xf0) lo = 0x90;
+                        if (c == 0xf4) hi = 0x8f;
+                } else {
                         return false;
-                len -= n;
-                str += n;
+                }
+
+                if (len - i - 1 < n || s[i + 1] < lo || s[i + 1] > hi)
+                        return false;
+
+                for (int j = 2; j <= n; ++j)
+                        if ((s[i + j] & 0xc0) != 0x80)
+                                return false;
+
+                i += n + 1;
         }
 
         return true;
 }
 
+/*
+ * Transcodes `src` from CP1252, or ISO 8859-1 if `latin1`, into `dst`,
+ * which needs room for 3 * strlen(src) + 1 bytes. Returns the length of
+ * the result.
+ */
+inline static size_t
+utf8_from_legacy(char *dst, char const *src, bool latin1)
+{
+        /* 0x80 to 0x9f, where CP1252 differs; the holes are left as C1 controls */
+        static uint16_t const cp1252[32] = {
+                0x20ac, 0x0081, 0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021,
+                0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008d, 0x017d, 0x008f,
+                0x0090, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014,
+                0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0x009d, 0x017e, 0x0178,
+        };
+
+        char *d = dst;
+
+        for (unsigned char const *s = (unsigned char const *)src; *s != '\0'; ++s) {
+                uint32_t cp = *s;
+
+                if (cp >= 0x80 && cp < 0xa0 && !latin1)
+                        cp = cp1252[cp - 0x80];
+
+                if (cp < 0x80) {
+                        *d++ = cp;
+                } else if (cp < 0x800) {
+                        *d++ = 0xc0 | (cp >> 6);
+                        *d++ = 0x80 | (cp & 0x3f);
+                } else {
+                        *d++ = 0xe0 | (cp >> 12);
+                        *d++ = 0x80 | ((cp >> 6) & 0x3f);
+                        *d++ = 0x80 | (cp & 0x3f);
+                }
+        }
+
+        *d = '\0';
+
+        return d - dst;
+}
+
+/* longer clusters are cut up; nothing but abuse of combining marks comes close */
+#define UTF8_CLUSTER_MAX 64
+
+/*
+ * The length of the grapheme cluster (UAX #29) at the start of `str`, at
+ * most `len` bytes, and in `width` the columns it takes up. Controls and
+ * invalid bytes come on their own, with a width of zero.
+ *
+ * A cluster is as wide as its first character and any spacing marks,
+ * except that a variation selector asking for emoji presentation makes it
+ * two wide, as does a pair of regional indicators (a flag).
+ *
+ * This always works it out; utf8_cluster() remembers emoji.
+ */
+inline static int
+utf8_segment(char const *str, int len, int *width)
+{
+        uint32_t cp;
+        int n = next_utf8(str, len, &cp);
+
+        *width = 0;
+
+        if (n == -1)
+                return 1;
+
+        int prev = unicode_break(cp);
+        int w = unicode_width(cp);
+
+        if (prev == GCB_CR && n < len && str[n] == '\n')
+                return n + 1;
+
+        if (prev == GCB_CR || prev == GCB_LF || prev == GCB_CONTROL || w < 0)
+                return n;
+
+        bool pictographic = (prev == GCB_PICTOGRAPHIC); /* whether this is ExtPict Extend* */
+        bool joiner = false; /* whether the last ZWJ came after ExtPict Extend* */
+        int ris = (prev == GCB_RI);
+
+        while (n < len) {
+                int bytes = next_utf8(str + n, len - n, &cp);
+                if (bytes == -1 || n + bytes > UTF8_CLUSTER_MAX)
+                        break;
+
+                int next = unicode_break(cp);
+                bool join;
+
+                switch (next) {
+                case GCB_CR:
+                case GCB_LF:
+                case GCB_CONTROL:
+                        join = false;
+                        break;
+                case GCB_EXTEND:
+                case GCB_ZWJ:
+                case GCB_SPACING_MARK:
+                        join = true;
+                        break;
+                default:
+                        join = prev == GCB_PREPEND
+                            || (prev == GCB_L && (next == GCB_L || next == GCB_V || next == GCB_LV || next == GCB_LVT))
+                            || ((prev == GCB_LV || prev == GCB_V) && (next == GCB_V || next == GCB_T))
+                            || ((prev == GCB_LVT || prev == GCB_T) && next == GCB_T)
+                            || (prev == GCB_ZWJ && joiner && next == GCB_PICTOGRAPHIC)
+                            || (prev == GCB_RI && next == GCB_RI && ris % 2 == 1);
+                }
+
+                if (!join)
+                        break;
+
+                if ((next == GCB_SPACING_MARK || prev == GCB_PREPEND) && unicode_width(cp) > 0)
+                        w += unicode_width(cp);
+                if (cp == 0xfe0f || next == GCB_RI)
+                        w = 2;
+
+                if (next == GCB_ZWJ)
+                        joiner = pictographic;
+                if (next != GCB_EXTEND)
+                        pictographic = (next == GCB_PICTOGRAPHIC);
+                ris += (next == GCB_RI);
+
+                prev = next;
+                n += bytes;
+        }
+
+        *width = w;
+
+        return n;
+}
+
+/* utf8_segment() through a cache, in src/utf8.c */
+int utf8_emoji(char const *str, int len, int *width);
+
+/*
+ * utf8_segment(), except that clusters starting with an emoji or a regional
+ * indicator from outside the BMP, which is where the long ones (ZWJ
+ * sequences, flags, skin tones) are, are only segmented the first time
+ * they're seen.
+ */
+inline static int
+utf8_cluster(char const *str, int len, int *width)
+{
+        uint32_t cp;
+
+        if ((unsigned char)str[0] >= 0xf0 && next_utf8(str, len, &cp) == 4) {
+                int gcb = unicode_break(cp);
+                if (gcb == GCB_PICTOGRAPHIC || gcb == GCB_RI)
+                        return utf8_emoji(str, len, width);
+        }
+
+        return utf8_segment(str, len, width);
+}
+
 inline static int
 utf8_fit(char const *str, int len, int cols)
 {
         int n = 0;
-#define SKIP { bytes = 1; goto next; }
+
         while (len != 0) {
                 int bytes;
                 int width = 0;
 
+                bytes = utf8_ascii(str, (len < cols) ? len : cols);
+                if (bytes != 0) {
+                        cols -= bytes;
+                        goto next;
+                }
+
                 /* handle color codes -- bad! */
                 if (str[0] == 3) {
                         if (len > 1 && str[1] == '#') {
@@ -94,18 +354,7 @@ utf8_fit(char const *str, int len, int cols)
                         goto next;
                 }
 
-                uint32_t cp;
-                bytes = next_utf8(str, len, &cp);
-                if (bytes == -1)
-                        SKIP;
-
-                /* Skip C0 or C1 controls */
-                if (cp < 0x20 || (cp >= 0x80 && cp < 0xa0))
-                        SKIP;
-
-                width = mk_wcwidth(cp);
-                if (width == -1)
-                        SKIP;
+                bytes = utf8_cluster(str, len, &width);
 
                 if (cols - width < 0)
                         break;
@@ -116,7 +365,7 @@ next:
                 len -= bytes;
                 n += bytes;
         }
-#undef SKIP
+
         return n;
 }
 
@@ -124,59 +373,39 @@ inline static int
 utf8_width(char const *str, int len)
 {
         int w = 0;
-#define SKIP { bytes = 1; goto next; }
-        while (len != 0) {
-                uint32_t cp;
-                int bytes = next_utf8(str, len, &cp);
-                if (bytes == -1)
-                        SKIP;
 
-                /* Skip C0 or C1 controls */
-                if (cp < 0x20 || (cp >= 0x80 && cp < 0xa0))
-                        SKIP;
+        while (len != 0) {
+                int bytes = utf8_ascii(str, len);
+                if (bytes != 0) {
+                        w += bytes;
+                        goto next;
+                }
 
-                int width = mk_wcwidth(cp);
-                if (width == -1)
-                        SKIP;
+                int width;
+                bytes = utf8_cluster(str, len, &width);
 
                 w += width;
 next:
                 str += bytes;
                 len -= bytes;
         }
-#undef SKIP
+
         return w;
 }
 
+/* the grapheme cluster at the start of NUL-terminated `str`, see utf8_cluster() */
 inline static int
 utf8_next(char const *str, int *w)
 {
-        *w = 0;
-        int n = 0;
-
-        while (*str != '\0') {
-                uint32_t cp;
-                int bytes = next_utf8(str, 16, &cp);
-                if (bytes == -1)
-                        break;
-
-                /* Skip C0 or C1 controls */
-                if (cp < 0x20 || (cp >= 0x80 && cp < 0xa0))
-                        break;
+        unsigned char const *s = (unsigned char const *)str;
 
-                int width = mk_wcwidth(cp);
-                if (width == -1)
-                        break;
-
-                if (*w > 0 && width > 0)
-                        break;
-
-                *w += width;
-                n += bytes;
-                str += bytes;
+        /* a printable ASCII character followed by ASCII can't have anything combining with it */
+        if (s[0] >= 0x20 && s[0] < 0x7f && s[1] < 0x80) {
+                *w = 1;
+                return 1;
         }
 
-        return (n == 0) ? 1 : n;
+        return utf8_cluster(str, INT_MAX, w);
 }
 
 #endif
@@ -0,0 +1,64 @@
+#ifndef WHEEL_H_INCLUDED
+#define WHEEL_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * A hierarchical timer wheel with a tick of one millisecond. Level 0 has a
+ * slot for each of the next 64 ticks, level 1 a slot for each of the next
+ * 64 turns of level 0, and so on; a timer goes in the slot for when it
+ * expires at the lowest level that reaches that far, and moves down as
+ * the levels below come round to it. Adding and cancelling a timer is
+ * O(1), and so is finding out when the next one is due.
+ *
+ * Timers are owned by the caller and live in the wheel while pending.
+ */
+
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+typedef void WheelHandler(void *ctx);
+
+typedef struct wheel_timer {
+        struct wheel_timer *next;
+        struct wheel_timer **pprev; /* NULL while it isn't pending */
+        uint64_t expires;
+        uint8_t level;
+        uint8_t slot;
+        WheelHandler *fn;
+        void *ctx;
+} WheelTimer;
+
+typedef struct {
+        uint64_t now;
+        uint64_t occupied[WHEEL_LEVELS]; /* a bit for each non-empty slot */
+        WheelTimer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} Wheel;
+
+void
+wheel_init(Wheel *w, uint64_t now);
+
+/* (re)schedule `t` for `expires`, which is taken to be the next tick if it's already past */
+void
+wheel_add(Wheel *w, WheelTimer *t, uint64_t expires);
+
+void
+wheel_cancel(Wheel *w, WheelTimer *t);
+
+inline static bool
+wheel_pending(WheelTimer const *t)
+{
+        return t->pprev != NULL;
+}
+
+/* the earliest time anything might need doing, -1 if nothing is pending */
+int64_t
+wheel_next(Wheel const *w);
+
+/* move the time on to `now`, calling the handlers of the timers that expire on the way */
+void
+wheel_advance(Wheel *w, uint64_t now);
+
+#endif
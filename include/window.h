@@ -2,7 +2,9 @@
 #define WINDOW_H_INCLUDED
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "buffer.h"
+#include "search.h"
 
 typedef struct window Window;
 
@@ -32,6 +34,10 @@ struct window {
                         bool resize;
                         bool search;
                         bool nicks;
+                        bool global;
+                        Query query;
+                        uint64_t drawn; /* signatures of what was last drawn, see ui.c */
+                        uint64_t drawn_line;
                 };
         };
 };
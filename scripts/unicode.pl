@@ -0,0 +1,193 @@
+#!/usr/bin/env perl
+#
+# Generates include/unicode.h, a two-stage table of terminal column widths
+# and grapheme cluster break properties, from the Unicode Character Database:
+#
+#   perl scripts/unicode.pl UnicodeData.txt EastAsianWidth.txt \
+#           auxiliary/GraphemeBreakProperty.txt emoji/emoji-data.txt > include/unicode.h
+#
+# `make unicode` fetches the files and does this.
+#
+# Widths follow Markus Kuhn's wcwidth(), which this replaces:
+#   -1  C0 and C1 controls and DEL
+#    0  NUL, non-spacing and enclosing marks (Mn, Me), format characters (Cf)
+#       other than SOFT HYPHEN and the prepended concatenation marks, ZERO
+#       WIDTH SPACE and Hangul Jamo vowels and trailing consonants
+#    2  East Asian Wide and Fullwidth, which includes emoji with emoji
+#       presentation and, by default, unassigned code points in CJK blocks
+#    1  everything else
+#
+# The break property is Grapheme_Cluster_Break, with Extended_Pictographic
+# folded in as one more value, since UAX #29 only asks about it for code
+# points that are otherwise Other.
+
+use strict;
+use warnings;
+
+my ($unicode_data, $east_asian_width, $grapheme_break, $emoji_data) = @ARGV;
+die "usage: $0 UnicodeData.txt EastAsianWidth.txt GraphemeBreakProperty.txt emoji-data.txt\n"
+        unless defined $emoji_data;
+
+# in the order of the enum in the output
+my @breaks = qw(
+        Other CR LF Control Extend ZWJ Regional_Indicator Prepend SpacingMark
+        L V T LV LVT Extended_Pictographic
+);
+my %break = map { $breaks[$_] => $_ } 0 .. $#breaks;
+
+my $MAX = 0x110000;
+my $BLOCK = 256;
+
+my @width = (1) x $MAX;
+my $version = 'unknown';
+
+# East Asian Width first, so that the general category can override it
+open my $eaw, '<', $east_asian_width or die "$east_asian_width: $!\n";
+while (<$eaw>) {
+        $version = $1 if /^# EastAsianWidth-(\d+\.\d+\.\d+)\.txt/;
+
+        # unlisted code points in these ranges take the default given
+        s/^#\s*\@missing:\s*//;
+        s/#.*//;
+        next unless /^([0-9A-F]+)(?:\.\.([0-9A-F]+))?\s*;\s*(\w+)/i;
+
+        my ($first, $last) = (hex $1, hex($2 // $1));
+        my $w = ($3 eq 'W' || $3 eq 'F') ? 2 : 1;
+        @width[$first .. $last] = ($w) x ($last - $first + 1);
+}
+close $eaw;
+
+open my $ud, '<', $unicode_data or die "$unicode_data: $!\n";
+my $first;
+while (<$ud>) {
+        my ($code, $name, $category) = split /;/;
+        my $cp = hex $code;
+
+        # ranges are given as a pair of <..., First> and <..., Last> entries
+        if ($name =~ /, First>$/) {
+                $first = $cp;
+                next;
+        }
+        my $from = ($name =~ /, Last>$/) ? $first : $cp;
+
+        next unless $category =~ /^(Mn|Me|Cf)$/;
+        @width[$from .. $cp] = (0) x ($cp - $from + 1);
+}
+close $ud;
+
+$width[$_] = -1 for 0x01 .. 0x1f, 0x7f .. 0x9f;
+$width[0x00] = 0;
+$width[0x00ad] = 1;
+$width[0x200b] = 0;
+$width[$_] = 0 for 0x1160 .. 0x11ff, 0xd7b0 .. 0xd7ff;
+
+# prepended concatenation marks are Cf, but they're drawn
+$width[$_] = 1 for 0x0600 .. 0x0605, 0x06dd, 0x070f, 0x0890 .. 0x0891, 0x08e2, 0x110bd, 0x110cd;
+
+my @break = (0) x $MAX;
+
+# "0300..036F    ; Extend # ..." and the like
+sub ranges {
+        my ($path, $each) = @_;
+        open my $f, '<', $path or die "$path: $!\n";
+        while (<$f>) {
+                s/#.*//;
+                next unless /^([0-9A-F]+)(?:\.\.([0-9A-F]+))?\s*;\s*(\w+)/i;
+                $each->(hex $1, hex($2 // $1), $3);
+        }
+        close $f;
+}
+
+ranges($grapheme_break, sub {
+        my ($first, $last, $value) = @_;
+        die "$grapheme_break: unknown property $value\n" unless exists $break{$value};
+        @break[$first .. $last] = ($break{$value}) x ($last - $first + 1);
+});
+
+ranges($emoji_data, sub {
+        my ($first, $last, $value) = @_;
+        return unless $value eq 'Extended_Pictographic';
+        for ($first .. $last) {
+                $break[$_] = $break{$value} if $break[$_] == $break{Other};
+        }
+});
+
+# each entry is the break property in the high bits and the width plus one in the low two
+my @entry = map { $break[$_] << 2 | ($width[$_] + 1) } 0 .. $MAX - 1;
+
+# stage one maps the top bits of a code point to one of the distinct blocks in stage two
+my (@stage1, @stage2, %seen);
+for (my $cp = 0; $cp < $MAX; $cp += $BLOCK) {
+        my $block = join ',', @entry[$cp .. $cp + $BLOCK - 1];
+        unless (exists $seen{$block}) {
+                $seen{$block} = @stage2 / $BLOCK;
+                push @stage2, @entry[$cp .. $cp + $BLOCK - 1];
+        }
+        push @stage1, $seen{$block};
+}
+
+my $blocks = @stage2 / $BLOCK;
+my $index = ($blocks <= 256) ? 'uint8_t' : 'uint16_t';
+
+sub table {
+        my ($per_line, @values) = @_;
+        my $out = '';
+        while (my @line = splice @values, 0, $per_line) {
+                $out .= '        ' . join(', ', @line) . ",\n";
+        }
+        return $out;
+}
+
+my %short = (Regional_Indicator => 'RI', SpacingMark => 'SPACING_MARK', Extended_Pictographic => 'PICTOGRAPHIC');
+my $enum = join '', map { '        GCB_' . ($short{$_} // uc $_) . ",\n" } @breaks;
+
+print <<"EOF";
+#ifndef UNICODE_H_INCLUDED
+#define UNICODE_H_INCLUDED
+
+/*
+ * Generated by scripts/unicode.pl from Unicode $version, don't edit.
+ *
+ * Terminal column widths and grapheme cluster break properties as a
+ * two-stage table: unicode_stage1 picks one of $blocks distinct $BLOCK-entry
+ * blocks in unicode_stage2 for each block of code points.
+ */
+
+#include <stdint.h>
+
+/* Grapheme_Cluster_Break, plus Extended_Pictographic for what would be Other */
+enum {
+$enum};
+
+static $index const unicode_stage1[] = {
+@{[ table(16, @stage1) ]}};
+
+/* the break property times four, plus the width plus one */
+static uint8_t const unicode_stage2[] = {
+@{[ table(16, @stage2) ]}};
+
+inline static int
+unicode_entry(uint32_t cp)
+{
+        if (cp >= @{[ sprintf "0x%X", $MAX ]})
+                return 2;
+
+        return unicode_stage2[unicode_stage1[cp >> 8] << 8 | (cp & 0xff)];
+}
+
+/* -1 for controls, otherwise the number of columns `cp` takes up */
+inline static int
+unicode_width(uint32_t cp)
+{
+        return (unicode_entry(cp) & 3) - 1;
+}
+
+/* one of the GCB_ values */
+inline static int
+unicode_break(uint32_t cp)
+{
+        return unicode_entry(cp) >> 2;
+}
+
+#endif
+EOF
@@ -3,6 +3,10 @@
 #include "util.h"
 #include "tsmap.h"
 #include "message.h"
+#include "loop.h"
+
+/* a buffer nothing has been added to for this long, in ms, closes its log and gives back spare memory */
+#define IDLE_TIMEOUT (10 * 60 * 1000)
 
 Input *
 input_new(Input *prev, Input *next)
@@ -15,6 +19,34 @@ input_new(Input *prev, Input *next)
         return input;
 }
 
+static FILE *
+open_log(Buffer const *b)
+{
+        char path[4096];
+        char const *home = getenv("HOME");
+        snprintf(path, sizeof path, "%s/.eria/logs/%s.%s", home, b->network->name, b->name);
+
+        return fopen(path, "a");
+}
+
+static void
+hibernate(void *ctx, int events)
+{
+        Buffer *b = ctx;
+
+        if (b->log != NULL)
+                fclose(b->log);
+
+        b->log = NULL;
+        b->asleep = true;
+
+        /* what vec_push() grew the messages by and hasn't needed since */
+        if (b->messages.count != 0 && b->messages.capacity > b->messages.count) {
+                b->messages.capacity = b->messages.count;
+                resize(b->messages.items, b->messages.capacity * sizeof *b->messages.items);
+        }
+}
+
 Buffer *
 buffer_new(char const *name, Network *network, int type)
 {
@@ -27,12 +59,11 @@ buffer_new(char const *name, Network *network, int type)
         b->tsm = tsmap_new();
         vec_init(b->messages);
         b->input = b->last = input_new(NULL, NULL);
+        b->log = open_log(b);
+        b->asleep = false;
 
-        char path[4096];
-        char const *home = getenv("HOME");
-        snprintf(path, sizeof path, "%s/.eria/logs/%s.%s", home, network->name, name);
-
-        b->log = fopen(path, "a");
+        /* armed by buffer_add(), since buffers are also made on the networks' threads */
+        b->idle = loop_timer(hibernate, b);
 
         return b;
 }
@@ -58,6 +89,13 @@ buffer_add(Buffer *b, Eria *state, Message *m)
         vec_push(b->messages, m);
         scroll(state->root, b);
 
+        if (b->asleep) {
+                b->log = open_log(b);
+                b->asleep = false;
+        }
+
+        loop_arm(b->idle, IDLE_TIMEOUT);
+
         if (b->log != NULL)
                 msg_log(m, b->log);
 }
@@ -1,13 +1,12 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
-#include <poll.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <termkey.h>
 #include <time.h>
-#include <sys/time.h>
+#include <signal.h>
 #include <libsrsirc/irc.h>
 #include <libsrsirc/irc_ext.h>
 #include <libsrsirc/irc_track.h>
@@ -24,14 +23,43 @@
 #include "message.h"
 #include "util.h"
 #include "log.h"
+#include "gsearch.h"
+#include "utf8.h"
+#include "loop.h"
+#include "ingest.h"
+
+/* shortest time between two frames, in ms, unless a key was pressed */
+#define FRAME_INTERVAL 33
+
+/* how long to wait for the rest of a burst of SIGWINCHes before resizing, in ms */
+#define RESIZE_DELAY 20
+
+/* a server that's been quiet this long gets a PING, and one that doesn't answer in PING_TIMEOUT is dropped */
+#define PING_INTERVAL 60000
+#define PING_TIMEOUT  30000
+
+/* the first wait before reconnecting, doubled after each failed attempt up to RECONNECT_MAX, give or take half */
+#define RECONNECT_MIN 1000
+#define RECONNECT_MAX 300000
+
+/* how long the UI thread spends on the networks' events each time it wakes up, in ms */
+#define APPLY_BUDGET 8
 
 static Eria *_state;
 
-static void *
-try_connect(void *ctx)
-{
-        return irc_connect(ctx) ? ctx : NULL;
-}
+/* loop_now() on entering main(), for the startup times */
+static intmax_t started;
+
+/* whether there's anything new to draw, and whether it should be drawn right away */
+static bool dirty;
+static bool typed;
+
+static Timer *frame_timer;
+static Timer *rooms_timer;
+static Timer *resize_timer;
+
+/* when the networks' events have to give way to input and drawing */
+static intmax_t apply_until;
 
 static void
 set_nick_pattern(Network *network, char const *nick)
@@ -39,7 +67,7 @@ set_nick_pattern(Network *network, char const *nick)
         if (network->nick_regex != NULL)
                 re_free(network->nick_regex);
 
-        static vec(char) pattern;
+        static _Thread_local vec(char) pattern;
         pattern.count = 0;
 
         char start[] = "(^|[^a-zA-Z0-9_])";
@@ -79,9 +107,10 @@ important(Eria const *state)
 
 enum { ALL_CHANS_QUIT, ALL_CHANS_NICK };
 static void
-user_do_all_chans(irc *ctx, char const *ident, int type, ...)
+user_do_all_chans(Network *network, char const *ident, int type, ...)
 {
-        static vec(chanrep) chans;
+        static _Thread_local vec(chanrep) chans;
+        irc *ctx = network->connection;
         int n = irc_num_chans(ctx);
         vec_reserve(chans, n);
 
@@ -129,16 +158,11 @@ user_do_all_chans(irc *ctx, char const *ident, int type, ...)
 
         for (int i = 0; i < n; ++i) {
                 if (irc_member(ctx, &user, chans.items[i].name, ident) != NULL) {
-                        Buffer *buffer = chans.items[i].tag;
-                        if (buffer != NULL) switch (type) {
-                        case ALL_CHANS_QUIT:
-                                buffer_add(buffer, _state, m);
-                                break;
-                        case ALL_CHANS_NICK:
-                                tsmap_update(buffer->tsm, nick);
-                                buffer_add(buffer, _state, m);
-                                break;
-                        }
+                        Event e = { .type = EV_MESSAGE, .buffer = chans.items[i].tag, .message = m };
+                        if (type == ALL_CHANS_NICK)
+                                snprintf(e.nick, sizeof e.nick, "%s", nick);
+                        if (e.buffer != NULL)
+                                ingest_push(network, &e);
                 }
         }
 
@@ -154,15 +178,39 @@ find_buffer(Network const *network, char const *name)
         return NULL;
 }
 
+/* `chan` was joined or refused; tell the UI thread when that was the last of those asked for on connecting */
+static void
+settle(Network *network, char const *chan)
+{
+        for (size_t i = 0; i < network->joining.count; ++i) {
+                if (lsi_ut_istrcmp(network->joining.items[i], chan, 0) == 0) {
+                        char *name;
+                        vec_pop_ith(network->joining, i, name);
+                        free(name);
+                        if (network->joining.count == 0)
+                                ingest_push(network, &(Event){ .type = EV_JOINED });
+                        return;
+                }
+        }
+}
+
+/* hand `m` to the UI thread, to be added to `b` */
 static void
-react(Eria *state, Network *network, tokarr tokens)
+post(Network *network, Buffer *b, Message *m)
+{
+        ingest_push(network, &(Event){ .type = EV_MESSAGE, .buffer = b, .message = m });
+}
+
+/* on the network's thread, with its lock held */
+static void
+react(Network *network, tokarr tokens)
 {
         irc *ctx = network->connection;
         char const *me = irc_mynick(ctx);
         char nick[64];
 
         char lower[512];
-        char raw[512] = {0};
+        char raw[3 * 512] = {0}; /* recode() can triple a line's length */
 
         if (tokens[0] != NULL) {
                 lsi_ut_ident2nick(nick, sizeof nick, tokens[0]);
@@ -176,12 +224,19 @@ react(Eria *state, Network *network, tokarr tokens)
         }
 
         Message *raw_msg = msg("[server]", "%", raw);
-        buffer_add(network->buffers.items[0], state, raw_msg);
+        post(network, network->buffers.items[0], raw_msg);
+
+        /* the ways a server can refuse to let us into a channel, which name it in tokens[3] */
+        static char const *const refusals[] = { "403", "405", "471", "473", "474", "475", "476", "477" };
+        for (size_t i = 0; i < sizeof refusals / sizeof *refusals; ++i)
+                if (strcmp(tokens[1], refusals[i]) == 0 && tokens[3] != NULL)
+                        settle(network, tokens[3]);
 
 #define CASE(s) if (strcmp(tokens[1], #s) == 0) {
 #define END     return; }
         CASE(PRIVMSG)
                 Buffer *b = NULL;
+                bool new = false;
 
                 lsi_ut_strtolower(lower, sizeof lower, tokens[3], 0);
 
@@ -193,9 +248,13 @@ react(Eria *state, Network *network, tokarr tokens)
                         if (irc_user(ctx, &u, nick) != NULL)
                                 b = u.tag;
                         if (b == NULL) {
-                                b = buffer_new(sclone(nick), network, B_USER);
-                                vec_push(network->buffers, b);
-                                bell();
+                                /* a conversation from before a reconnect carries on where it was */
+                                b = find_buffer(network, nick);
+                                if (b == NULL) {
+                                        b = buffer_new(sclone(nick), network, B_USER);
+                                        vec_push(network->buffers, b);
+                                        new = true;
+                                }
                                 irc_tag_user(ctx, nick, b, false);
                         }
                 } else {
@@ -217,33 +276,30 @@ react(Eria *state, Network *network, tokarr tokens)
 
                 m->important = mentions_me;
 
-                if ((b->type == B_USER || m->important) && b != state->window->buffer) {
-                        b->activity = A_IMPORTANT;
-                        bell();
-                } else if (b->activity == A_NONE) {
-                        b->activity = A_NORMAL;
-                }
-
-                buffer_add(b, state, m);
-                tsmap_update(b->tsm, nick);
+                Event e = { .type = EV_MESSAGE, .buffer = b, .message = m, .activity = true, .bell = new };
+                snprintf(e.nick, sizeof e.nick, "%s", nick);
+                ingest_push(network, &e);
         END
 
         CASE(JOIN)
                 if (strcmp(me, nick) == 0) {
+                        /* after a reconnect, the channel's still open */
                         Buffer *b = find_buffer(network, tokens[2]);
-                        if (b == NULL)
+                        if (b == NULL) {
                                 b = buffer_new(tokens[2], network, B_CHANNEL);
+                                vec_push(network->buffers, b);
+                                ingest_push(network, &(Event){ .type = EV_FOCUS, .buffer = b });
+                        }
                         irc_tag_chan(ctx, tokens[2], b, false);
-                        vec_push(network->buffers, b);
-                        state->window->buffer = b;
+                        settle(network, tokens[2]);
                 } else {
                         chanrep chan;
                         irc_chan(ctx, &chan, tokens[2]);
                         Buffer *b = chan.tag;
                         if (b != NULL) {
-                                buffer_add(
+                                post(
+                                        network,
                                         b,
-                                        state,
                                         msg(
                                                 "^-->^",
                                                 "^%^ (%) ^has joined^ %",
@@ -265,9 +321,9 @@ react(Eria *state, Network *network, tokarr tokens)
                         irc_chan(ctx, &chan, tokens[2]);
                         Buffer *b = chan.tag;
                         if (b != NULL) {
-                                buffer_add(
+                                post(
+                                        network,
                                         b,
-                                        state,
                                         msg(
                                                 "^<--^",
                                                 "^%^ (%) ^has left^ % (%)",
@@ -307,7 +363,7 @@ react(Eria *state, Network *network, tokarr tokens)
                                 mode_params,
                                 b->name
                         );
-                        buffer_add(b, state, m);
+                        post(network, b, m);
                 } else /* user mode */ {
                         Buffer *b = network->buffers.items[0];
                         Message *m = msg(
@@ -320,7 +376,7 @@ react(Eria *state, Network *network, tokarr tokens)
                                 ui_nick_color(tokens[2]),
                                 tokens[2]
                         );
-                        buffer_add(b, state, m);
+                        post(network, b, m);
                 }
         END
 
@@ -334,7 +390,7 @@ react(Eria *state, Network *network, tokarr tokens)
                         C_TOPIC,
                         tokens[4]
                 );
-                buffer_add(b, state, m);
+                post(network, b, m);
         END
 
         CASE(KICK)
@@ -364,14 +420,14 @@ react(Eria *state, Network *network, tokarr tokens)
                                 nick
                         )
                 ;
-                buffer_add(b, state, m);
+                post(network, b, m);
         END
 
         CASE(NICK)
                 if (strcmp(me, tokens[2]) == 0) {
                         set_nick_pattern(network, me);
                 } else {
-                        user_do_all_chans(ctx, tokens[2], ALL_CHANS_NICK, nick);
+                        user_do_all_chans(network, tokens[2], ALL_CHANS_NICK, nick);
                 }
         END
 
@@ -381,6 +437,10 @@ react(Eria *state, Network *network, tokarr tokens)
                 else
                         irc_printf(ctx, "PONG :%s", tokens[2]);
         END
+
+        CASE(PONG)
+                ingest_push(network, &(Event){ .type = EV_PONG });
+        END
 #undef END
 #undef CASE
 }
@@ -391,30 +451,316 @@ h_quit(irc *ctx, tokarr *msg, size_t argc, bool pre)
         char const *ident = (*msg)[0];
         char const *reason = (*msg)[2];
 
-        user_do_all_chans(ctx, ident, ALL_CHANS_QUIT, reason);
+        for (int i = 0; i < _state->networks.count; ++i)
+                if (_state->networks.items[i]->connection == ctx)
+                        user_do_all_chans(_state->networks.items[i], ident, ALL_CHANS_QUIT, reason);
 
         return true;
 }
 
-inline static void
+/* a line from eria itself in the network's server buffer */
+static void
+note(Eria *state, Network *network, char const *text)
+{
+        buffer_add(network->buffers.items[0], state, msg("^--^", "%", C_MISC, text));
+        dirty = true;
+}
+
+static irc *
+connection_new(NetworkConfig const *net)
+{
+        irc *ctx = irc_init();
+        if (ctx == NULL)
+                panic("out of memory");
+        irc_set_server(ctx, net->server, net->port);
+        irc_set_nick(ctx, net->nick);
+        irc_set_uname(ctx, net->user);
+        irc_set_fname(ctx, net->real);
+        irc_set_connect_timeout(ctx, 0, net->timeout);
+        irc_set_track(ctx, true);
+        irc_reg_msghnd(ctx, "QUIT", h_quit, true);
+        if (net->sasl.mechanism && net->sasl.key) {
+                irc_set_sasl(
+                        ctx,
+                        net->sasl.mechanism,
+                        net->sasl.key,
+                        strlen(net->sasl.key),
+                        true
+                );
+        }
+        return ctx;
+}
+
+static NetworkConfig const *
+config_of(Eria const *state, Network const *network)
+{
+        int i = 0;
+        while (state->networks.items[i] != network)
+                ++i;
+        return &state->config->networks[i];
+}
+
+/* somewhere between half of `ms` and all of it, so networks that went down together don't all come back at once */
+static intmax_t
+jitter(intmax_t ms)
+{
+        static uint64_t x;
+
+        if (x == 0)
+                x = ((uint64_t)loop_now() << 20 ^ (uint64_t)getpid()) | 1;
+
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+
+        return ms / 2 + (intmax_t)(x % (uint64_t)(ms / 2 + 1));
+}
+
+/* try again once the backoff is up, and back off further for the time after */
+static void
+retry(Eria *state, Network *network, char const *why)
+{
+        intmax_t wait = jitter(network->backoff);
+
+        network->status = NET_OFFLINE;
+
+        char text[128];
+        snprintf(text, sizeof text, "%s, reconnecting in %jds", why, (wait + 500) / 1000);
+        note(state, network, text);
+
+        loop_arm(network->reconnect, wait);
+
+        network->backoff *= 2;
+        if (network->backoff > RECONNECT_MAX)
+                network->backoff = RECONNECT_MAX;
+}
+
+static void
+connected(Network *network)
+{
+        network->status = NET_ONLINE;
+        network->ping_sent = -1;
+        loop_arm(network->keepalive, PING_INTERVAL);
+}
+
+/* ask for `chan` and wait for it, unless that's already being done */
+static void
+join(Network *network, char const *chan)
+{
+        for (size_t i = 0; i < network->joining.count; ++i)
+                if (lsi_ut_istrcmp(network->joining.items[i], chan, 0) == 0)
+                        return;
+
+        irc_printf(network->connection, "JOIN %s", chan);
+        vec_push(network->joining, sclone(chan));
+}
+
+/* the channels that were open when the last connection went, and those to join on connecting that aren't */
+static void
+join_channels(Eria const *state, Network *network)
+{
+        for (size_t i = 0; i < network->joining.count; ++i)
+                free(network->joining.items[i]);
+        network->joining.count = 0;
+
+        for (int i = 0; i < network->buffers.count; ++i)
+                if (network->buffers.items[i]->type == B_CHANNEL)
+                        join(network, network->buffers.items[i]->name);
+
+        for (char const * const *chan = config_of(state, network)->channels; *chan != NULL; ++chan) {
+                /* the server may have spelled it differently when we joined it before */
+                bool open = false;
+                for (int i = 0; i < network->buffers.count; ++i)
+                        open = open || lsi_ut_istrcmp(network->buffers.items[i]->name, *chan, 0) == 0;
+
+                if (!open)
+                        join(network, *chan);
+        }
+}
+
+/* note how long it took to get going, the first time it has */
+static void
+started_up(Eria *state)
+{
+        if (state->startup.usable == -1) {
+                state->startup.usable = loop_now() - started;
+                char text[64];
+                snprintf(text, sizeof text, "ready %jdms after starting", state->startup.usable);
+                note(state, state->networks.items[0], text);
+        }
+
+        if (state->startup.joined != -1)
+                return;
+
+        for (int i = 0; i < state->networks.count; ++i) {
+                Network *network = state->networks.items[i];
+                if (network->status != NET_ONLINE || network->joining.count != 0)
+                        return;
+        }
+
+        state->startup.joined = loop_now() - started;
+        char text[64];
+        snprintf(text, sizeof text, "all networks joined %jdms after starting", state->startup.joined);
+        note(state, state->networks.items[0], text);
+}
+
+static void
 disconnected(Eria *state, Network *network)
 {
-        irc_connect(network->connection);
+        network->ping_sent = -1;
+        network->lag = -1;
+        loop_disarm(network->keepalive);
+
+        retry(state, network, "disconnected");
 }
 
-inline static void
-consume(Eria *state, Network *network)
+/* start connecting again, on the network's thread; what comes of it comes back as an event */
+static void
+on_reconnect(void *ctx, int events)
 {
-        static tokarr tokens;
-        irc *ctx = network->connection;
+        Network *network = ctx;
+        NetworkConfig const *net = config_of(_state, network);
+
+        if (network->status != NET_OFFLINE)
+                return;
+
+        network->status = NET_CONNECTING;
+
+        char text[128];
+        snprintf(text, sizeof text, "connecting to %s:%hu", net->server, net->port);
+        note(_state, network, text);
+
+        ingest_connect(network, connection_new(net));
+}
+
+static void
+on_keepalive(void *ctx, int events)
+{
+        Network *network = ctx;
+
+        /* nothing at all came back since the PING */
+        if (network->ping_sent != -1) {
+                irc_reset(network->connection);
+                ingest_wake(network);
+                disconnected(_state, network);
+                return;
+        }
+
+        irc_printf(network->connection, "PING :eria");
+        network->ping_sent = loop_now();
+        loop_arm(network->keepalive, PING_TIMEOUT);
+}
+
+/*
+ * Lines that aren't valid UTF-8 are taken to be in the network's fallback
+ * encoding and transcoded, so nothing past here has to deal with bad input.
+ */
+static void
+recode(Network const *network, tokarr tokens)
+{
+        static _Thread_local vec(char) out;
+        int const count = sizeof (tokarr) / sizeof tokens[0];
+        size_t need = 0;
+        bool valid = true;
+
+        for (int i = 0; i < count; ++i) {
+                if (tokens[i] == NULL)
+                        continue;
+                size_t n = strlen(tokens[i]);
+                valid = valid && utf8_valid(tokens[i], n);
+                need += 3 * n + 1;
+        }
+
+        if (valid)
+                return;
+
+        vec_reserve(out, need);
+
+        char *dst = out.items;
+        for (int i = 0; i < count; ++i) {
+                if (tokens[i] == NULL)
+                        continue;
+                size_t n = utf8_from_legacy(dst, tokens[i], network->fallback == ENC_LATIN1);
+                tokens[i] = dst;
+                dst += n + 1;
+        }
+}
+
+/* each line read on the network's thread */
+static void
+ingest(Network *network, tokarr tokens)
+{
+        recode(network, tokens);
+        react(network, tokens);
+}
+
+/* what the network's thread made of what it read, on the UI thread */
+static void
+apply(Eria *state, Network *network)
+{
+        Event e;
+        int n = 0;
+
+        while (ingest_pop(network, &e)) {
+                switch (e.type) {
+                case EV_MESSAGE:
+                        if (e.activity) {
+                                Buffer *b = e.buffer;
+                                if ((b->type == B_USER || e.message->important) && b != state->window->buffer) {
+                                        b->activity = A_IMPORTANT;
+                                        bell();
+                                } else if (b->activity == A_NONE) {
+                                        b->activity = A_NORMAL;
+                                }
+                        }
+                        if (e.bell)
+                                bell();
+                        buffer_add(e.buffer, state, e.message);
+                        if (e.nick[0] != '\0')
+                                tsmap_update(e.buffer->tsm, e.nick);
+                        break;
+                case EV_JOINED:
+                        started_up(state);
+                        break;
+                case EV_FOCUS:
+                        state->window->buffer = e.buffer;
+                        break;
+                case EV_PONG:
+                        if (network->ping_sent != -1) {
+                                network->lag = loop_now() - network->ping_sent;
+                                network->ping_sent = -1;
+                        }
+                        break;
+                case EV_DEAD:
+                        disconnected(state, network);
+                        break;
+                case EV_CONNECTED:
+                        network->backoff = RECONNECT_MIN;
+                        connected(network);
+                        set_nick_pattern(network, irc_mynick(network->connection));
+                        note(state, network, "connected");
+                        join_channels(state, network);
+                        if (network->joining.count == 0)
+                                started_up(state);
+                        break;
+                case EV_FAILED:
+                        retry(state, network, "couldn't connect");
+                        break;
+                }
 
-        for (;;) switch (irc_read(ctx, &tokens, 1)) {
-        case  1: react(state, network, tokens); break;
-        case  0:                                return;
-        case -1:                                goto Dead;
+                /* whatever doesn't fit in the budget is left for the next time round, after input and drawing */
+                if (++n % 64 == 0 && loop_now() >= apply_until)
+                        break;
         }
-Dead:
-        disconnected(state, network);
+
+        if (n == 0)
+                return;
+
+        dirty = true;
+
+        /* it's alive, so put off the next PING, or if there's one out, giving up on it */
+        if (irc_online(network->connection))
+                loop_arm(network->keepalive, (network->ping_sent == -1) ? PING_INTERVAL : PING_TIMEOUT);
 }
 
 static Network *
@@ -423,10 +769,24 @@ network_new(char const *name, irc *connection)
         Network *n = alloc(sizeof *n);
         n->name = name;
         n->connection = connection;
+        n->status = NET_OFFLINE;
         n->nick_regex = NULL;
+        n->fallback = ENC_CP1252;
+        n->ingest = NULL;
+        n->reconnect = loop_timer(on_reconnect, n);
+        n->keepalive = loop_timer(on_keepalive, n);
+        n->backoff = RECONNECT_MIN;
+        n->ping_sent = -1;
+        n->lag = -1;
+        vec_init(n->joining);
         vec_init(n->buffers);
         vec_push(n->buffers, buffer_new(irc_get_host(connection), n, B_SERVER));
         set_nick_pattern(n, irc_get_nick(connection));
+
+        /* held by the UI thread but while it's waiting */
+        pthread_mutex_init(&n->lock, NULL);
+        pthread_mutex_lock(&n->lock);
+
         return n;
 }
 
@@ -438,26 +798,14 @@ configure(Eria *state, Config *config)
         Network **networks = state->networks.items;
 
         for (NetworkConfig *net = config->networks; net->name != NULL; ++net) {
-                irc *ctx = irc_init();
-                if (ctx == NULL)
-                        panic("out of memory");
-                irc_set_server(ctx, net->server, net->port);
-                irc_set_nick(ctx, net->nick);
-                irc_set_uname(ctx, net->user);
-                irc_set_fname(ctx, net->real);
-                irc_set_connect_timeout(ctx, 0, net->timeout);
-                irc_set_track(ctx, true);
-                irc_reg_msghnd(ctx, "QUIT", h_quit, true);
-                if (net->sasl.mechanism && net->sasl.key) {
-                        irc_set_sasl(
-                                ctx,
-                                net->sasl.mechanism,
-                                net->sasl.key,
-                                strlen(net->sasl.key),
-                                true
-                        );
-                }
-                networks[state->networks.count++] = network_new(net->name, ctx);
+                Network *network = network_new(net->name, connection_new(net));
+                if (net->encoding == NULL || strcmp(net->encoding, "cp1252") == 0)
+                        network->fallback = ENC_CP1252;
+                else if (strcmp(net->encoding, "latin1") == 0)
+                        network->fallback = ENC_LATIN1;
+                else
+                        panic("%s: unknown encoding '%s'", net->name, net->encoding);
+                networks[state->networks.count++] = network;
         }
 }
 
@@ -475,32 +823,119 @@ clear_activity(Window *w)
         }
 }
 
-/* time in ms since last call to elapsed() */
-static intmax_t
-elapsed(void)
+static void
+on_input(void *ctx, int events)
+{
+        Eria *state = ctx;
+        TermKeyKey input;
+
+        typed = dirty = true;
+
+        termkey_advisereadable(state->tk);
+        while (termkey_getkey(state->tk, &input) == TERMKEY_RES_KEY) {
+                static char key[64];
+                termkey_strfkey(state->tk, key, sizeof key, &input, TERMKEY_FORMAT_ALTISMETA);
+                if (input.type == TERMKEY_TYPE_UNICODE && input.modifiers == 0)
+                        handle_text(state, input.utf8);
+                else
+                        handle_key(state, key);
+        }
+}
+
+/* events from one of the networks' threads */
+static void
+on_network(void *ctx, int events)
 {
-        static struct timeval last;
-        struct timeval now;
+        apply(_state, ctx);
+}
 
-        gettimeofday(&now, NULL);
+/* let the networks' threads at the connections while there's nothing else to do */
+static void
+unlock_networks(void *ctx)
+{
+        Eria *state = ctx;
+
+        for (int i = 0; i < state->networks.count; ++i)
+                pthread_mutex_unlock(&state->networks.items[i]->lock);
+}
 
-        uintmax_t dt = 1000ULL * (now.tv_sec - last.tv_sec)
-                     + (now.tv_usec - last.tv_usec) / 1000ULL;
+static void
+lock_networks(void *ctx)
+{
+        Eria *state = ctx;
 
-        last = now;
+        for (int i = 0; i < state->networks.count; ++i)
+                pthread_mutex_lock(&state->networks.items[i]->lock);
 
-        return dt;
+        apply_until = loop_now() + APPLY_BUDGET;
+}
+
+/* results from the global search workers */
+static void
+on_search(void *ctx, int events)
+{
+        if (gsearch_collect())
+                dirty = true;
+}
+
+/* the terminal can take more of a frame it couldn't take all at once */
+static void
+on_output(void *ctx, int events)
+{
+        ui_drain();
+}
+
+static void
+on_frame(void *ctx, int events)
+{
+        /* nothing to do but wake up; what's dirty is drawn after this */
+}
+
+static void
+on_rooms(void *ctx, int events)
+{
+        dirty = true;
+}
+
+static void
+on_winch(void *ctx, int events)
+{
+        if (!loop_armed(resize_timer))
+                loop_arm(resize_timer, RESIZE_DELAY);
+}
+
+static void
+on_resize(void *ctx, int events)
+{
+        ui_resize();
+        typed = dirty = true;
+}
+
+static void
+on_term(void *ctx, int events)
+{
+        Eria *state = ctx;
+        quit(state, state->config->quit_message);
 }
 
 int
 main(void)
 {
-        Eria state = { .fds = { { .fd = STDIN_FILENO, .events = POLLIN } } };
+        Eria state = { .redraw_timeout = -1, .startup = { -1, -1 } };
         _state = &state;
+
+        started = loop_now();
+
+        /* before configure() arms any timers, and before any threads, which leave these signals to the loop */
+        loop_init();
+        loop_signal(SIGWINCH, on_winch, &state);
+        loop_signal(SIGTERM, on_term, &state);
+
         configure(&state, &config);
 
-        /* initialize elapsed()'s state */
-        elapsed();
+        frame_timer = loop_timer(on_frame, &state);
+        rooms_timer = loop_timer(on_rooms, &state);
+        resize_timer = loop_timer(on_resize, &state);
 
         /* very good */
         system("mkdir -p ~/.eria/logs");
@@ -516,80 +951,80 @@ main(void)
         
         if (fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK, 1) == -1)
                 epanic("fcntl()");
-        
-        ui_draw(&state);
 
-        /* start connecting to all of our networks */
-        pthread_t threads[ERIA_MAX_NETWORKS];
+        /*
+         * Every network connects, registers and joins its channels on its
+         * own thread, while the UI is already up; they come online one by
+         * one, and one that's slow or down doesn't hold up the others.
+         */
+        loop_watch(STDIN_FILENO, LOOP_IN, on_input, &state);
         for (int i = 0; i < state.networks.count; ++i) {
-                irc *ctx = state.networks.items[i]->connection;
-                int e = pthread_create(&threads[i], NULL, try_connect, ctx);
-                if (e != 0)
-                        panic("failed to spawn thread during startup: %s", strerror(e));
-        }
+                Network *network = state.networks.items[i];
 
-        for (int i = 0; i < state.networks.count; ++i) {
-                void *good;
-                int e = pthread_join(threads[i], &good);
-                if (e != 0)
-                        panic("failed to join thread during startup: %s", strerror(e));
-                if (!good)
-                        fprintf(stderr, "warning: couldn't connect to %s:%hu\n",
-                           config.networks[i].server, config.networks[i].port);
+                ingest_start(network, ingest);
+                loop_watch(ingest_fd(network), LOOP_IN, on_network, network);
+                on_reconnect(network, 0);
         }
 
-        /* autojoin channels */
-        for (int i = 0; i < state.networks.count; ++i) {
-                Network *network = state.networks.items[i];
-                irc *ctx = network->connection;
-                if (irc_online(ctx)) {
-                        char const **chan = config.networks[i].channels;
-                        while (*chan != NULL)
-                                irc_printf(ctx, "JOIN %s", *chan++);
-                }
-        }
+        loop_around_wait(unlock_networks, lock_networks, &state);
+
+        dirty = !ui_draw(&state);
+        if (!dirty)
+                started_up(&state);
+
+        intmax_t last_frame = loop_now();
+        int search = -1;
+        bool writing = false;
 
         for (;;) {
-                for (int i = 0; i < state.networks.count; ++i) {
-                        irc *ctx = state.networks.items[i]->connection;
-                        state.fds[1 + i].fd = irc_sockfd(ctx);
-                        state.fds[1 + i].events = POLLIN;
+                /* the search workers' pipe only exists once there's been a search */
+                if (search == -1 && (search = gsearch_fd()) != -1)
+                        loop_watch(search, LOOP_IN, on_search, &state);
+
+                /* wait for the terminal only while part of a frame is still waiting for it */
+                if ((ui_output_fd() != -1) != writing) {
+                        writing = !writing;
+                        if (writing)
+                                loop_watch(STDOUT_FILENO, LOOP_OUT, on_output, &state);
+                        else
+                                loop_unwatch(STDOUT_FILENO);
                 }
 
-                int r = poll(state.fds, 1 + state.networks.count, state.redraw_timeout);
-                if (r == -1)
-                        continue;
+                typed = false;
 
-                intmax_t dt = elapsed();
-                if (dt >= state.redraw_timeout)
-                        state.redraw_timeout = -1;
-                else
-                        state.redraw_timeout -= dt;
-
-                /* check if there is anything on stdin */
-                if (state.fds[0].revents & POLLIN) {
-                        TermKeyKey input;
-                        termkey_advisereadable(state.tk);
-                        while (termkey_getkey(state.tk, &input) == TERMKEY_RES_KEY) {
-                                static char key[64];
-                                termkey_strfkey(state.tk, key, sizeof key, &input, TERMKEY_FORMAT_ALTISMETA);
-                                if (input.type == TERMKEY_TYPE_UNICODE && input.modifiers == 0)
-                                        handle_text(&state, input.utf8);
-                                else
-                                        handle_key(&state, key);
+                loop_wait();
 
-                        }
+                /* input asks for the room list to be shown for a while by setting this */
+                if (state.redraw_timeout != -1) {
+                        loop_arm(rooms_timer, state.redraw_timeout);
+                        state.redraw_timeout = -1;
+                        dirty = true;
                 }
 
-                /* check for messages from the ircds we're connected to */
-                for (int i = 0; i < state.networks.count; ++i)
-                        if (state.fds[1 + i].revents & (POLLIN | POLLHUP))
-                                consume(&state, state.networks.items[i]);
+                if (!dirty)
+                        continue;
+
+                /*
+                 * Keystrokes are drawn right away; everything else is drawn
+                 * at most once per FRAME_INTERVAL, however fast it arrives,
+                 * and not while the terminal is still taking the last frame.
+                 */
+                intmax_t since_frame = loop_now() - last_frame;
+                if (!typed && since_frame < FRAME_INTERVAL) {
+                        if (ui_output_fd() == -1 && !loop_armed(frame_timer))
+                                loop_arm(frame_timer, FRAME_INTERVAL - since_frame);
+                        continue;
+                }
 
                 clear_activity(state.root);
 
-                state.draw_rooms = important(&state) || state.redraw_timeout != -1;
-                ui_draw(&state);
+                state.draw_rooms = important(&state) || loop_armed(rooms_timer);
+                if (ui_draw(&state)) {
+                        dirty = false;
+                        last_frame = loop_now();
+                        loop_disarm(frame_timer);
+                        started_up(&state);
+                }
         }
 
         return 0;
@@ -0,0 +1,329 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "eria.h"
+#include "buffer.h"
+#include "search.h"
+#include "gsearch.h"
+#include "panic.h"
+#include "alloc.h"
+#include "vec.h"
+
+enum {
+        MAX_WORKERS = 4,
+        MAX_RESULTS = 1 << 16,
+        BATCH       = 64,
+        /* how many messages a worker scans between checks for cancellation */
+        CHECK_EVERY = 256,
+};
+
+struct search {
+        atomic_int refs;
+        unsigned gen;
+        Query query;
+};
+
+struct job {
+        struct search *search;
+        Buffer *buffer;
+        Message **messages;
+        size_t count;
+};
+
+typedef vec(Result) rvec;
+
+/* shared with the workers, guarded by `lock` */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static vec(struct job) jobs;
+static rvec pending;
+static int busy;
+
+static atomic_uint generation;
+static int wake[2] = { -1, -1 };
+
+/* UI thread only */
+static struct search *current;
+static rvec results;
+static rvec merged;
+static rvec batch;
+
+static void
+release(struct search *s)
+{
+        if (atomic_fetch_sub(&s->refs, 1) == 1) {
+                query_free(&s->query);
+                free(s);
+        }
+}
+
+inline static bool
+cancelled(struct search const *s)
+{
+        return atomic_load_explicit(&generation, memory_order_relaxed) != s->gen;
+}
+
+static void
+publish(struct search const *s, Result const *rs, int n)
+{
+        bool notify = false;
+
+        pthread_mutex_lock(&lock);
+        /* gsearch_cancel() empties `pending` under the lock, so nothing stale gets in */
+        if (!cancelled(s) && n != 0) {
+                notify = (pending.count == 0);
+                vec_push_n(pending, rs, n);
+        }
+        pthread_mutex_unlock(&lock);
+
+        if (notify)
+                write(wake[1], "", 1);
+}
+
+static void
+scan(struct job const *job)
+{
+        struct search const *s = job->search;
+        Result rs[BATCH];
+        int n = 0;
+
+        for (size_t i = job->count; i-- > 0;) {
+                if (i % CHECK_EVERY == 0 && cancelled(s))
+                        return;
+
+                Message *m = job->messages[i];
+                int d = query_message(&s->query, m);
+                if (d != -1) {
+                        rs[n++] = (Result) { .buffer = job->buffer, .message = m, .distance = d };
+                        if (n == BATCH) {
+                                publish(s, rs, n);
+                                n = 0;
+                        }
+                }
+        }
+
+        publish(s, rs, n);
+}
+
+static void *
+worker(void *ctx)
+{
+        for (;;) {
+                pthread_mutex_lock(&lock);
+                while (jobs.count == 0)
+                        pthread_cond_wait(&work, &lock);
+                struct job job = *vec_pop(jobs);
+                busy += 1;
+                pthread_mutex_unlock(&lock);
+
+                scan(&job);
+
+                pthread_mutex_lock(&lock);
+                busy -= 1;
+                bool done = (busy == 0 && jobs.count == 0);
+                pthread_mutex_unlock(&lock);
+
+                /* let the UI know that we're no longer searching */
+                if (done)
+                        write(wake[1], "", 1);
+
+                release(job.search);
+                free(job.messages);
+        }
+
+        return NULL;
+}
+
+static void
+spawn(void)
+{
+        if (pipe(wake) == -1)
+                epanic("pipe()");
+
+        fcntl(wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake[1], F_SETFL, O_NONBLOCK);
+
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n < 1)
+                n = 1;
+        if (n > MAX_WORKERS)
+                n = MAX_WORKERS;
+
+        for (long i = 0; i < n; ++i) {
+                pthread_t t;
+                int e = pthread_create(&t, NULL, worker, NULL);
+                if (e != 0)
+                        panic("failed to spawn search thread: %s", strerror(e));
+                pthread_detach(t);
+        }
+}
+
+/* closest matches first; among equally close ones, the newest first */
+static int
+best_first(void const *a, void const *b)
+{
+        Result const *x = a;
+        Result const *y = b;
+
+        if (x->distance != y->distance)
+                return x->distance - y->distance;
+
+        return msg_time_cmp(y->message, x->message);
+}
+
+void
+gsearch_cancel(void)
+{
+        atomic_fetch_add(&generation, 1);
+
+        pthread_mutex_lock(&lock);
+        for (size_t i = 0; i < jobs.count; ++i) {
+                release(jobs.items[i].search);
+                free(jobs.items[i].messages);
+        }
+        jobs.count = 0;
+        pending.count = 0;
+        pthread_mutex_unlock(&lock);
+
+        results.count = 0;
+
+        if (current != NULL) {
+                release(current);
+                current = NULL;
+        }
+}
+
+void
+gsearch_update(Eria *state, char const *text, size_t n)
+{
+        if (current == NULL && n == 0)
+                return;
+
+        if (current != NULL
+            && n + 1 == current->query.text.count
+            && memcmp(current->query.text.items, text, n) == 0)
+                return;
+
+        gsearch_cancel();
+
+        if (n == 0)
+                return;
+
+        if (wake[0] == -1)
+                spawn();
+
+        struct search *s = alloc(sizeof *s);
+        atomic_init(&s->refs, 1);
+        s->gen = atomic_load(&generation);
+        query_init(&s->query);
+        query_set(&s->query, text, n);
+
+        current = s;
+
+        if (s->query.bad)
+                return;
+
+        pthread_mutex_lock(&lock);
+
+        for (int i = 0; i < state->networks.count; ++i) {
+                Network *network = state->networks.items[i];
+                for (size_t j = 0; j < network->buffers.count; ++j) {
+                        Buffer *b = network->buffers.items[j];
+                        size_t count = b->messages.count;
+                        if (count == 0)
+                                continue;
+
+                        /* the buffer keeps growing (and moving) while the workers scan it */
+                        Message **messages = alloc(count * sizeof *messages);
+                        memcpy(messages, b->messages.items, count * sizeof *messages);
+
+                        atomic_fetch_add(&s->refs, 1);
+
+                        struct job job = {
+                                .search = s,
+                                .buffer = b,
+                                .messages = messages,
+                                .count = count
+                        };
+
+                        vec_push(jobs, job);
+                }
+        }
+
+        pthread_cond_broadcast(&work);
+        pthread_mutex_unlock(&lock);
+}
+
+int
+gsearch_fd(void)
+{
+        return wake[0];
+}
+
+bool
+gsearch_collect(void)
+{
+        char drain[64];
+        while (read(wake[0], drain, sizeof drain) > 0)
+                ;
+
+        batch.count = 0;
+
+        pthread_mutex_lock(&lock);
+        rvec tmp = pending;
+        pending = batch;
+        batch = tmp;
+        pthread_mutex_unlock(&lock);
+
+        if (batch.count == 0)
+                return false;
+
+        qsort(batch.items, batch.count, sizeof *batch.items, best_first);
+
+        merged.count = 0;
+        vec_reserve(merged, results.count + batch.count);
+
+        size_t i = 0;
+        size_t j = 0;
+
+        while (merged.count < MAX_RESULTS && (i < results.count || j < batch.count)) {
+                if (j == batch.count || (i < results.count && best_first(&results.items[i], &batch.items[j]) <= 0))
+                        merged.items[merged.count++] = results.items[i++];
+                else
+                        merged.items[merged.count++] = batch.items[j++];
+        }
+
+        tmp = results;
+        results = merged;
+        merged = tmp;
+
+        return true;
+}
+
+Result const *
+gsearch_results(size_t *n)
+{
+        *n = results.count;
+        return results.items;
+}
+
+Query const *
+gsearch_query(void)
+{
+        return (current == NULL) ? NULL : &current->query;
+}
+
+bool
+gsearch_busy(void)
+{
+        pthread_mutex_lock(&lock);
+        bool b = (jobs.count != 0 || busy != 0);
+        pthread_mutex_unlock(&lock);
+        return b;
+}
@@ -0,0 +1,266 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+
+#include "ingest.h"
+#include "alloc.h"
+#include "panic.h"
+#include "vec.h"
+
+/* events in flight per network; a power of two */
+#define RING_SIZE 1024
+
+struct ingest {
+        Network *network;
+        IngestHandler *fn;
+        pthread_t thread;
+
+        int ready[2]; /* the thread tells the UI there are events */
+        int wake[2];  /* the UI tells the thread to look again */
+
+        /* the thread only */
+        vec(Event) spill;
+
+        _Atomic(irc *) dial; /* a connection to connect, from ingest_connect() */
+
+        atomic_bool waiting; /* the thread is waiting for room in the ring */
+        _Alignas(64) atomic_size_t head; /* next to pop, moved by the UI */
+        _Alignas(64) atomic_size_t tail; /* next to push, moved by the thread */
+        Event ring[RING_SIZE];
+};
+
+static void
+nonblocking_pipe(int fds[2])
+{
+        if (pipe(fds) == -1)
+                epanic("pipe()");
+
+        for (int i = 0; i < 2; ++i) {
+                fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+                fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+        }
+}
+
+static void
+poke(int fd)
+{
+        write(fd, "", 1);
+}
+
+static void
+drain(int fd)
+{
+        char b[64];
+        while (read(fd, b, sizeof b) > 0)
+                ;
+}
+
+static bool
+put(struct ingest *in, Event const *e)
+{
+        size_t tail = atomic_load_explicit(&in->tail, memory_order_relaxed);
+
+        if (tail - atomic_load(&in->head) == RING_SIZE)
+                return false;
+
+        in->ring[tail & (RING_SIZE - 1)] = *e;
+        atomic_store_explicit(&in->tail, tail + 1, memory_order_release);
+
+        return true;
+}
+
+/* move what was held back into the ring, as far as it goes; true if any of it did */
+static bool
+flush(struct ingest *in)
+{
+        int i = 0;
+
+        for (;;) {
+                while (i < in->spill.count && put(in, &in->spill.items[i]))
+                        ++i;
+                if (i == in->spill.count)
+                        break;
+
+                /* full, so ask to be woken when there's room, unless there already is */
+                atomic_store(&in->waiting, true);
+                if (!put(in, &in->spill.items[i]))
+                        break;
+                ++i;
+        }
+
+        memmove(in->spill.items, in->spill.items + i, (in->spill.count - i) * sizeof *in->spill.items);
+        in->spill.count -= i;
+
+        return i != 0;
+}
+
+static void
+dial(struct ingest *in, irc *connection)
+{
+        Network *network = in->network;
+
+        if (!irc_connect(connection)) {
+                irc_dispose(connection);
+                ingest_push(network, &(Event){ .type = EV_FAILED });
+                return;
+        }
+
+        pthread_mutex_lock(&network->lock);
+        irc *old = network->connection;
+        network->connection = connection;
+        irc_dispose(old);
+        pthread_mutex_unlock(&network->lock);
+
+        ingest_push(network, &(Event){ .type = EV_CONNECTED });
+}
+
+static void *
+run(void *arg)
+{
+        struct ingest *in = arg;
+        Network *network = in->network;
+        tokarr tokens;
+
+        for (;;) {
+                if (in->spill.count != 0 && flush(in))
+                        poke(in->ready[1]);
+
+                irc *connection = atomic_exchange(&in->dial, NULL);
+                if (connection != NULL) {
+                        dial(in, connection);
+                        poke(in->ready[1]);
+                }
+
+                pthread_mutex_lock(&network->lock);
+                int fd = irc_sockfd(network->connection);
+                pthread_mutex_unlock(&network->lock);
+
+                /* the socket isn't read while anything is held back, so a flood waits in the kernel */
+                struct pollfd fds[] = {
+                        { .fd = in->wake[0], .events = POLLIN },
+                        { .fd = (in->spill.count == 0) ? fd : -1, .events = POLLIN },
+                };
+
+                if (poll(fds, 2, -1) == -1)
+                        continue;
+
+                if (fds[0].revents & POLLIN)
+                        drain(in->wake[0]);
+
+                if (!(fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+                        continue;
+
+                while (in->spill.count == 0) {
+                        pthread_mutex_lock(&network->lock);
+
+                        /* the UI thread may have dropped it since, and the fd gone to something else */
+                        if (!irc_online(network->connection)) {
+                                pthread_mutex_unlock(&network->lock);
+                                break;
+                        }
+
+                        int r = irc_read(network->connection, &tokens, 1);
+                        if (r == 1)
+                                in->fn(network, tokens);
+                        else if (r == -1)
+                                irc_reset(network->connection);
+
+                        pthread_mutex_unlock(&network->lock);
+
+                        if (r == -1)
+                                ingest_push(network, &(Event){ .type = EV_DEAD });
+                        if (r != 1)
+                                break;
+                }
+
+                poke(in->ready[1]);
+        }
+
+        return NULL;
+}
+
+void
+ingest_start(Network *network, IngestHandler *fn)
+{
+        struct ingest *in = alloc(sizeof *in);
+
+        in->network = network;
+        in->fn = fn;
+        vec_init(in->spill);
+        atomic_init(&in->dial, NULL);
+        atomic_init(&in->waiting, false);
+        atomic_init(&in->head, 0);
+        atomic_init(&in->tail, 0);
+        nonblocking_pipe(in->ready);
+        nonblocking_pipe(in->wake);
+
+        network->ingest = in;
+
+        int e = pthread_create(&in->thread, NULL, run, in);
+        if (e != 0)
+                panic("couldn't start the thread for %s: %s", network->name, strerror(e));
+}
+
+void
+ingest_push(Network *network, Event const *e)
+{
+        struct ingest *in = network->ingest;
+
+        if (in->spill.count == 0 && put(in, e))
+                return;
+
+        vec_push(in->spill, *e);
+}
+
+int
+ingest_fd(Network const *network)
+{
+        return network->ingest->ready[0];
+}
+
+bool
+ingest_pop(Network *network, Event *e)
+{
+        struct ingest *in = network->ingest;
+        size_t head = atomic_load_explicit(&in->head, memory_order_relaxed);
+
+        if (head == atomic_load_explicit(&in->tail, memory_order_acquire)) {
+                /* only clear the notification once there's nothing left, so none is lost */
+                drain(in->ready[0]);
+                if (head == atomic_load_explicit(&in->tail, memory_order_acquire))
+                        return false;
+        }
+
+        *e = in->ring[head & (RING_SIZE - 1)];
+        atomic_store(&in->head, head + 1);
+
+        if (atomic_load(&in->waiting) && atomic_exchange(&in->waiting, false))
+                poke(in->wake[1]);
+
+        return true;
+}
+
+void
+ingest_wake(Network *network)
+{
+        if (network->ingest != NULL)
+                poke(network->ingest->wake[1]);
+}
+
+void
+ingest_connect(Network *network, irc *connection)
+{
+        irc *old = atomic_exchange(&network->ingest->dial, connection);
+        if (old != NULL)
+                irc_dispose(old);
+
+        poke(network->ingest->wake[1]);
+}
@@ -9,11 +9,15 @@
 #include "eria.h"
 #include "vec.h"
 #include "ui.h"
+#include "input.h"
+#include "gsearch.h"
+#include "search.h"
 #include "log.h"
+#include "loop.h"
 
 typedef void (Action)(Eria *);
 
-static void
+void
 quit(Eria *state, char const *msg)
 {
         if (msg == NULL)
@@ -195,13 +199,71 @@ cmd_bottom(Eria *state, char const *arg)
         window->scroll = 0;
 }
 
+static bool
+newer(Buffer const *a, Buffer const *b)
+{
+        if (a->messages.count == 0)
+                return false;
+        if (b->messages.count == 0)
+                return true;
+
+        return msg_time_cmp(*vec_last(a->messages), *vec_last(b->messages)) > 0;
+}
+
+/*
+ * Switch to the buffer whose name best matches `arg`. A bare name is matched
+ * with one typo allowed; "~~name" allows two, "/re/" is a regex. Ties go to
+ * the buffer with the most recent activity.
+ */
+static void
+cmd_buffer(Eria *state, char const *arg)
+{
+        if (arg == NULL)
+                return;
+
+        static vec(char) text;
+        text.count = 0;
+        if (arg[0] != '~' && arg[0] != '/')
+                vec_push(text, '~');
+        vec_push_n(text, arg, strlen(arg));
+
+        Query q;
+        query_init(&q);
+        query_set(&q, text.items, text.count);
+
+        Buffer *best = NULL;
+        int distance = -1;
+
+        for (int i = 0; i < state->networks.count; ++i) {
+                Network *network = state->networks.items[i];
+                for (size_t j = 0; j < network->buffers.count; ++j) {
+                        Buffer *b = network->buffers.items[j];
+                        int d = query_distance(&q, b->name, NULL);
+                        if (d == -1)
+                                continue;
+                        if (best == NULL || d < distance || (d == distance && newer(b, best))) {
+                                best = b;
+                                distance = d;
+                        }
+                }
+        }
+
+        query_free(&q);
+
+        if (best != NULL) {
+                state->window->buffer = best;
+                state->redraw_timeout = state->config->room_list_timeout;
+        }
+}
+
 static void
 cmd_reconnect(Eria *state, char const *arg)
 {
+        /* don't wait out the backoff; networks already connecting carry on */
         for (int i = 0; i < state->networks.count; ++i) {
-                irc *ctx = state->networks.items[i]->connection;
-                if (!irc_online(ctx))
-                        irc_connect(ctx);
+                Network *network = state->networks.items[i];
+                if (network->status == NET_OFFLINE)
+                        loop_arm(network->reconnect, 0);
         }
 }
 
@@ -212,7 +274,9 @@ command(Eria *state, char const *name, char const *arg)
                 char const *name;
                 void (*cmd)(Eria *, char const *);
         } cmds[] = {
+                { "b",          cmd_buffer     },
                 { "bottom",     cmd_bottom     },
+                { "buffer",     cmd_buffer     },
                 { "j",          cmd_join       },
                 { "join",       cmd_join       },
                 { "me",         cmd_me         },
@@ -397,6 +461,8 @@ vsplit(Eria *state)
 static void
 close_window(Eria *state)
 {
+        if (state->window->global && state->window->parent != NULL)
+                gsearch_cancel();
         state->window = window_delete(state->window);
 }
 
@@ -412,6 +478,14 @@ search_window(Eria *state)
         --state->window->search;
 }
 
+static void
+global_search(Eria *state)
+{
+        --state->window->global;
+        if (!state->window->global)
+                gsearch_cancel();
+}
+
 static void
 show_nicks(Eria *state)
 {
@@ -679,6 +753,7 @@ struct {
         { "C-d",        page_down     },
         { "C-e",        goto_end      },
         { "C-f",        show_nicks    },
+        { "C-g",        global_search },
         { "C-k",        cut_rest      },
         { "C-n",        jump_active   },
         { "C-q",        hsplit        },
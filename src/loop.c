@@ -0,0 +1,412 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#if defined(__linux__)
+#define USE_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#else
+#define USE_EPOLL 0
+#include <poll.h>
+#endif
+
+#include "loop.h"
+#include "wheel.h"
+#include "alloc.h"
+#include "panic.h"
+#include "vec.h"
+
+/* most events handled per wakeup; the rest are picked up next time */
+#define MAX_EVENTS 64
+
+/* one more than the highest signal number that can be handled */
+#define MAX_SIGNAL 65
+
+typedef struct {
+        LoopHandler *fn;
+        void *ctx;
+        int events; /* 0 if the fd isn't watched */
+#if !USE_EPOLL
+        int slot; /* index into `polled` */
+#endif
+} Source;
+
+struct timer {
+        WheelTimer entry;
+        LoopHandler *fn;
+        void *ctx;
+};
+
+/* indexed by fd */
+static vec(Source) sources;
+
+static Wheel wheel;
+
+static struct {
+        LoopHandler *fn;
+        void *ctx;
+} signals[MAX_SIGNAL];
+
+static struct {
+        LoopHook *before;
+        LoopHook *after;
+        void *ctx;
+} hooks;
+
+#if USE_EPOLL
+static int epfd = -1;
+static int sigfd = -1;
+static sigset_t sigmask;
+#else
+static vec(struct pollfd) polled;
+static int wake[2] = { -1, -1 };
+#endif
+
+static void
+take_signals(void *ctx, int events);
+
+static Source *
+source(int fd)
+{
+        if (fd < 0)
+                panic("loop: bad fd %d", fd);
+
+        if (fd >= sources.count) {
+                vec_reserve(sources, fd + 1);
+                memset(sources.items + sources.count, 0, (fd + 1 - sources.count) * sizeof *sources.items);
+                sources.count = fd + 1;
+        }
+
+        return &sources.items[fd];
+}
+
+intmax_t
+loop_now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (intmax_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* how long to wait for the next timer, in the form epoll_wait() and poll() take */
+static int
+timeout(void)
+{
+        int64_t next = wheel_next(&wheel);
+        if (next == -1)
+                return -1;
+
+        intmax_t ms = next - loop_now();
+        return (ms < 0) ? 0 : (ms > INT_MAX) ? INT_MAX : ms;
+}
+
+/* a hook that may be unset, and mustn't disturb errno from the wait it's next to */
+static void
+hook(LoopHook *fn)
+{
+        int e = errno;
+
+        if (fn != NULL)
+                fn(hooks.ctx);
+
+        errno = e;
+}
+
+void
+loop_around_wait(LoopHook *before, LoopHook *after, void *ctx)
+{
+        hooks.before = before;
+        hooks.after = after;
+        hooks.ctx = ctx;
+}
+
+#if USE_EPOLL
+
+void
+loop_init(void)
+{
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd == -1)
+                epanic("epoll_create1()");
+
+        wheel_init(&wheel, loop_now());
+
+        sigemptyset(&sigmask);
+}
+
+void
+loop_watch(int fd, int events, LoopHandler *fn, void *ctx)
+{
+        Source *s = source(fd);
+        struct epoll_event ev = {
+                .events = ((events & LOOP_IN) ? EPOLLIN : 0) | ((events & LOOP_OUT) ? EPOLLOUT : 0),
+                .data.fd = fd,
+        };
+
+        s->fn = fn;
+        s->ctx = ctx;
+
+        /* the fd may have been closed and reused behind our back, which drops it from the set */
+        if (epoll_ctl(epfd, s->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) == -1) {
+                int op = (errno == ENOENT) ? EPOLL_CTL_ADD : (errno == EEXIST) ? EPOLL_CTL_MOD : -1;
+                if (op == -1 || epoll_ctl(epfd, op, fd, &ev) == -1)
+                        epanic("loop: couldn't watch fd %d", fd);
+        }
+
+        s->events = events;
+}
+
+void
+loop_unwatch(int fd)
+{
+        if (fd < 0 || fd >= sources.count || sources.items[fd].events == 0)
+                return;
+
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &(struct epoll_event){ 0 });
+        sources.items[fd].events = 0;
+}
+
+void
+loop_signal(int signo, LoopHandler *fn, void *ctx)
+{
+        if (signo <= 0 || signo >= MAX_SIGNAL)
+                panic("loop: bad signal %d", signo);
+
+        signals[signo].fn = fn;
+        signals[signo].ctx = ctx;
+
+        sigaddset(&sigmask, signo);
+        if (sigprocmask(SIG_BLOCK, &sigmask, NULL) == -1)
+                epanic("sigprocmask()");
+
+        int fd = signalfd(sigfd, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (fd == -1)
+                epanic("signalfd()");
+
+        if (sigfd == -1) {
+                sigfd = fd;
+                loop_watch(sigfd, LOOP_IN, take_signals, NULL);
+        }
+}
+
+static void
+take_signals(void *ctx, int events)
+{
+        struct signalfd_siginfo info;
+
+        while (read(sigfd, &info, sizeof info) == sizeof info) {
+                int signo = info.ssi_signo;
+                if (signo < MAX_SIGNAL && signals[signo].fn != NULL)
+                        signals[signo].fn(signals[signo].ctx, LOOP_IN);
+        }
+}
+
+void
+loop_wait(void)
+{
+        struct epoll_event events[MAX_EVENTS];
+
+        int ms = timeout();
+
+        hook(hooks.before);
+        int n = epoll_wait(epfd, events, MAX_EVENTS, ms);
+        hook(hooks.after);
+        if (n == -1 && errno != EINTR)
+                epanic("epoll_wait()");
+
+        for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                Source *s = &sources.items[fd];
+
+                /* an earlier handler may have stopped watching it */
+                if (s->events == 0)
+                        continue;
+
+                int ready = 0;
+                if (events[i].events & EPOLLIN)
+                        ready |= LOOP_IN;
+                if (events[i].events & EPOLLOUT)
+                        ready |= LOOP_OUT;
+                if (events[i].events & (EPOLLERR | EPOLLHUP))
+                        ready |= s->events;
+
+                if (ready & s->events)
+                        s->fn(s->ctx, ready & s->events);
+        }
+
+        wheel_advance(&wheel, loop_now());
+}
+
+#else
+
+void
+loop_init(void)
+{
+        if (pipe(wake) == -1)
+                epanic("pipe()");
+
+        wheel_init(&wheel, loop_now());
+
+        fcntl(wake[0], F_SETFL, fcntl(wake[0], F_GETFL) | O_NONBLOCK);
+        fcntl(wake[1], F_SETFL, fcntl(wake[1], F_GETFL) | O_NONBLOCK);
+        fcntl(wake[0], F_SETFD, FD_CLOEXEC);
+        fcntl(wake[1], F_SETFD, FD_CLOEXEC);
+
+        loop_watch(wake[0], LOOP_IN, take_signals, NULL);
+}
+
+void
+loop_watch(int fd, int events, LoopHandler *fn, void *ctx)
+{
+        Source *s = source(fd);
+
+        if (s->events == 0) {
+                s->slot = polled.count;
+                vec_push(polled, ((struct pollfd){ .fd = fd }));
+        }
+
+        s->fn = fn;
+        s->ctx = ctx;
+        s->events = events;
+
+        polled.items[s->slot].events = ((events & LOOP_IN) ? POLLIN : 0) | ((events & LOOP_OUT) ? POLLOUT : 0);
+}
+
+void
+loop_unwatch(int fd)
+{
+        if (fd < 0 || fd >= sources.count || sources.items[fd].events == 0)
+                return;
+
+        /* move the last one into its place */
+        int slot = sources.items[fd].slot;
+        polled.items[slot] = polled.items[--polled.count];
+        sources.items[polled.items[slot].fd].slot = slot;
+
+        sources.items[fd].events = 0;
+}
+
+static void
+deliver(int signo)
+{
+        unsigned char b = signo;
+        int e = errno;
+        write(wake[1], &b, 1);
+        errno = e;
+}
+
+void
+loop_signal(int signo, LoopHandler *fn, void *ctx)
+{
+        if (signo <= 0 || signo >= MAX_SIGNAL)
+                panic("loop: bad signal %d", signo);
+
+        signals[signo].fn = fn;
+        signals[signo].ctx = ctx;
+
+        struct sigaction sa = { .sa_handler = deliver, .sa_flags = SA_RESTART };
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(signo, &sa, NULL) == -1)
+                epanic("sigaction()");
+}
+
+static void
+take_signals(void *ctx, int events)
+{
+        unsigned char b[64];
+        ssize_t n;
+
+        while ((n = read(wake[0], b, sizeof b)) > 0) {
+                for (ssize_t i = 0; i < n; ++i)
+                        if (b[i] < MAX_SIGNAL && signals[b[i]].fn != NULL)
+                                signals[b[i]].fn(signals[b[i]].ctx, LOOP_IN);
+        }
+}
+
+void
+loop_wait(void)
+{
+        int ms = timeout();
+
+        hook(hooks.before);
+        int n = poll(polled.items, polled.count, ms);
+        hook(hooks.after);
+        if (n == -1 && errno != EINTR)
+                epanic("poll()");
+
+        /* handlers can add and remove fds, so go by a copy of what was polled */
+        static vec(struct pollfd) ready;
+        ready.count = 0;
+        for (int i = 0; n > 0 && i < polled.count; ++i)
+                if (polled.items[i].revents != 0)
+                        vec_push(ready, polled.items[i]);
+
+        for (int i = 0; i < ready.count; ++i) {
+                Source *s = &sources.items[ready.items[i].fd];
+                short revents = ready.items[i].revents;
+
+                if (s->events == 0)
+                        continue;
+
+                int events = 0;
+                if (revents & POLLIN)
+                        events |= LOOP_IN;
+                if (revents & POLLOUT)
+                        events |= LOOP_OUT;
+                if (revents & (POLLERR | POLLHUP | POLLNVAL))
+                        events |= s->events;
+
+                if (events & s->events)
+                        s->fn(s->ctx, events & s->events);
+        }
+
+        wheel_advance(&wheel, loop_now());
+}
+
+#endif
+
+static void
+expire(void *ctx)
+{
+        Timer *t = ctx;
+        t->fn(t->ctx, LOOP_IN);
+}
+
+Timer *
+loop_timer(LoopHandler *fn, void *ctx)
+{
+        Timer *t = alloc(sizeof *t);
+
+        t->entry = (WheelTimer){ .fn = expire, .ctx = t };
+        t->fn = fn;
+        t->ctx = ctx;
+
+        return t;
+}
+
+void
+loop_arm(Timer *t, intmax_t ms)
+{
+        wheel_add(&wheel, &t->entry, loop_now() + ((ms > 0) ? ms : 0));
+}
+
+void
+loop_disarm(Timer *t)
+{
+        wheel_cancel(&wheel, &t->entry);
+}
+
+bool
+loop_armed(Timer const *t)
+{
+        return wheel_pending(&t->entry);
+}
@@ -81,7 +81,7 @@ fmt(char * restrict dst, char const * restrict fmt, va_list *ap)
 Message *
 msg(char const *tfmt, char const *bfmt, ...)
 {
-        static char buffer[1 << 16];
+        static _Thread_local char buffer[1 << 16];
         va_list ap;
 
         va_start(ap, bfmt);
@@ -150,3 +150,16 @@ msg_log(Message const *m, FILE *f)
 
         fflush(f);
 }
+
+int
+msg_time_cmp(Message const *a, Message const *b)
+{
+        struct tm const *x = &a->time;
+        struct tm const *y = &b->time;
+
+        if (x->tm_year != y->tm_year) return x->tm_year - y->tm_year;
+        if (x->tm_yday != y->tm_yday) return x->tm_yday - y->tm_yday;
+        if (x->tm_hour != y->tm_hour) return x->tm_hour - y->tm_hour;
+        if (x->tm_min  != y->tm_min)  return x->tm_min  - y->tm_min;
+        return x->tm_sec - y->tm_sec;
+}
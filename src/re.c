@@ -70,11 +70,6 @@ struct re_nfa {
         size_t alloc;
 };
 
-struct frame {
-        char const *s;
-        struct st const *state;
-};
-
 /*
  * Attempt to allocate a new `struct re`.
  * Return a null-pointer if the attempt fails.
@@ -549,83 +544,193 @@ parse(char const *s)
         return regexp(&s, false);
 }
 
+/*
+ * Matching is a Thompson/Pike simulation of the NFA: every live thread
+ * advances in lock-step over the input and a state is entered at most once
+ * per input position, so re_match() is O(states * length) for every
+ * pattern. Nothing a user can type into the search bar makes it blow up.
+ *
+ * Threads are kept in priority order (`one` is preferred over `two`, and
+ * earlier start positions over later ones), which finds the same leftmost
+ * match that the old backtracking matcher did.
+ */
+
+struct thread {
+        struct st const *state;
+        char const *start;
+};
+
+struct tlist {
+        struct thread *items;
+        size_t count;
+};
+
+struct vm {
+        struct tlist lists[2];
+        struct st const **stack;
+        unsigned *mark;
+        unsigned gen;
+        size_t capacity;
+};
+
+inline static bool
+consuming(struct transition const *tr)
+{
+        return tr->s != NULL && tr->t != NFA_EPSILON && tr->t != NFA_BEGIN && tr->t != NFA_END;
+}
+
 inline static bool
-charmatch(char const **s, struct transition const *tr, char const *begin)
+charmatch(struct transition const *tr, uint8_t c)
 {
         switch (tr->t) {
-        case NFA_EPSILON: return true;
-        case NFA_ANYCHAR: return (**s != '\0') && ++*s;
-        case NFA_BEGIN:   return *s == begin;
-        case NFA_END:     return **s == '\0';
-        case NFA_CLASS:   return **s != '\0' && searchclass(tr->class, tr->c, **s) && ++*s;
-        case NFA_NCLASS:  return **s != '\0' && !searchclass(tr->class, tr->c, **s) && ++*s;
-        case NFA_CHAR:    return **s == tr->c && ++*s;
+        case NFA_ANYCHAR: return c != '\0';
+        case NFA_CLASS:   return c != '\0' && searchclass(tr->class, tr->c, c);
+        case NFA_NCLASS:  return c != '\0' && !searchclass(tr->class, tr->c, c);
+        case NFA_CHAR:    return c == tr->c;
         default:          assert(false);
         }
 }
 
-static char *
-domatch(struct st const *state, char const *string, char const *begin)
+inline static bool
+zerowidth(struct transition const *tr, char const *s, char const *begin)
 {
-        static struct frame *stack = NULL;
-        static int capacity = 8;
-        int i = 0;
+        if (tr->s == NULL)
+                return false;
 
-        if (stack == NULL) {
-                stack = malloc(8 * sizeof *stack);
-                if (stack == NULL)
-                        return NULL;
+        switch (tr->t) {
+        case NFA_EPSILON: return true;
+        case NFA_BEGIN:   return s == begin;
+        case NFA_END:     return *s == '\0';
+        default:          return false;
         }
+}
 
-        stack[i++] = (struct frame){ .s = string, .state = state };
+static bool
+reserve(struct vm *vm, size_t n)
+{
+        if (vm->capacity >= n)
+                return true;
 
-        while (i != 0) {
-                struct frame f =  stack[--i];
-                char const *s = f.s;
+        for (int i = 0; i < 2; ++i) {
+                struct thread *tmp = realloc(vm->lists[i].items, n * sizeof *tmp);
+                if (tmp == NULL)
+                        return false;
+                vm->lists[i].items = tmp;
+        }
 
-                if (i + 2 >= capacity) {
-                        capacity *= 2;
-                        struct frame *tmp = realloc(stack, capacity * sizeof *stack);
-                        if (tmp == NULL)
-                                return NULL;
-                        else
-                                stack = tmp;
-                }
+        /* every state can be pushed once per incoming edge */
+        struct st const **stack = realloc(vm->stack, 2 * n * sizeof *stack);
+        if (stack == NULL)
+                return false;
+        vm->stack = stack;
 
-                if (f.state->one.s == NULL)
-                        return (char *)f.s;
-                if (f.state->two.s != NULL && charmatch(&s, &f.state->two, begin))
-                        stack[i++] = (struct frame){ .s = s, .state = f.state->two.s };
-                if (charmatch(&f.s, &f.state->one, begin))
-                        stack[i++] = (struct frame){ .s = f.s, .state = f.state->one.s };
+        unsigned *mark = realloc(vm->mark, n * sizeof *mark);
+        if (mark == NULL)
+                return false;
+        memset(mark, 0, n * sizeof *mark);
+        vm->mark = mark;
+        vm->gen = 0;
+
+        vm->capacity = n;
+
+        return true;
+}
+
+/*
+ * Add a thread for `state` and for everything reachable from it through
+ * zero-width transitions. Only states that can consume a character (or the
+ * accepting state) end up in the list.
+ */
+static void
+addthread(struct vm *vm, struct re_nfa const *nfa, struct tlist *l, struct st const *state, char const *start, char const *s, char const *begin)
+{
+        int n = 0;
+        vm->stack[n++] = state;
+
+        while (n != 0) {
+                struct st const *st = vm->stack[--n];
+                size_t i = st - nfa->states;
+
+                if (vm->mark[i] == vm->gen)
+                        continue;
+                vm->mark[i] = vm->gen;
+
+                if (st->one.s == NULL || consuming(&st->one) || consuming(&st->two))
+                        l->items[l->count++] = (struct thread){ .state = st, .start = start };
+
+                if (zerowidth(&st->two, s, begin))
+                        vm->stack[n++] = st->two.s;
+                if (zerowidth(&st->one, s, begin))
+                        vm->stack[n++] = st->one.s;
         }
+}
 
-        return NULL;
+inline static void
+step(struct vm *vm)
+{
+        if (++vm->gen == 0) {
+                memset(vm->mark, 0, vm->capacity * sizeof *vm->mark);
+                vm->gen = 1;
+        }
 }
 
 bool
 re_match(struct re_nfa const *nfa, char const *s, struct re_result *result)
 {
-        char *end;
-        if (end = domatch(nfa->states, s, s), end != NULL) {
-                if (result != NULL) {
-                        result->start = s;
-                        result->end   = end;
-                }
-                return true;
-        }
+        /* every thread gets its own scratch space (see gsearch.c) */
+        static _Thread_local struct vm vm;
+
+        if (!reserve(&vm, nfa->count))
+                return false;
+
+        struct tlist *clist = &vm.lists[0];
+        struct tlist *nlist = &vm.lists[1];
+        char const *begin = s;
+        bool matched = false;
+
+        clist->count = 0;
+        step(&vm);
+
+        for (;; ++s) {
+                /* a new attempt starting here has the lowest priority */
+                if (!matched)
+                        addthread(&vm, nfa, clist, nfa->states, s, s, begin);
 
-        while (*++s) {
-                if (end = domatch(nfa->states, s, NULL), end != NULL) {
-                        if (result != NULL) {
-                                result->start = s;
-                                result->end   = end;
+                if (clist->count == 0)
+                        break;
+
+                step(&vm);
+                nlist->count = 0;
+
+                for (size_t i = 0; i < clist->count; ++i) {
+                        struct thread t = clist->items[i];
+                        struct st const *st = t.state;
+
+                        if (st->one.s == NULL) {
+                                matched = true;
+                                if (result != NULL) {
+                                        result->start = t.start;
+                                        result->end   = s;
+                                }
+                                /* lower priority threads can't win any more */
+                                break;
                         }
-                        return true;
+
+                        if (consuming(&st->one) && charmatch(&st->one, *s))
+                                addthread(&vm, nfa, nlist, st->one.s, t.start, s + 1, begin);
+                        if (consuming(&st->two) && charmatch(&st->two, *s))
+                                addthread(&vm, nfa, nlist, st->two.s, t.start, s + 1, begin);
                 }
+
+                struct tlist *tmp = clist;
+                clist = nlist;
+                nlist = tmp;
+
+                if (*s == '\0')
+                        break;
         }
 
-        return false;
+        return matched;
 }
 
 re_pat *
@@ -0,0 +1,364 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "search.h"
+
+inline static unsigned char
+lower(unsigned char c)
+{
+        return (c - 'A' < 26u) ? (c | 0x20) : c;
+}
+
+inline static bool
+equal(char const *s, char const *needle, size_t m)
+{
+        for (size_t i = 0; i < m; ++i)
+                if (lower(s[i]) != lower(needle[i]))
+                        return false;
+        return true;
+}
+
+#if defined(__AVX2__)
+inline static __m256i
+lower32(__m256i x)
+{
+        __m256i upper = _mm256_and_si256(
+                _mm256_cmpgt_epi8(x, _mm256_set1_epi8('A' - 1)),
+                _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), x)
+        );
+
+        return _mm256_or_si256(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+#elif defined(__SSE2__)
+inline static __m128i
+lower16(__m128i x)
+{
+        __m128i upper = _mm_and_si128(
+                _mm_cmpgt_epi8(x, _mm_set1_epi8('A' - 1)),
+                _mm_cmplt_epi8(x, _mm_set1_epi8('Z' + 1))
+        );
+
+        return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+/*
+ * The vector kernels compare a block of candidate start positions against
+ * the first byte of the needle and the same block shifted by m - 1 against
+ * the last byte, and only verify the (rare) positions where both agree.
+ *
+ * They never read past s + n, so whatever is left over at the end is
+ * handed to the scalar loop.
+ */
+char const *
+search_icase(char const *s, size_t n, char const *needle, size_t m)
+{
+        if (m == 0)
+                return s;
+
+        if (m > n)
+                return NULL;
+
+        size_t i = 0;
+
+#if defined(__AVX2__)
+        __m256i first = _mm256_set1_epi8(lower(needle[0]));
+        __m256i last = _mm256_set1_epi8(lower(needle[m - 1]));
+
+        for (; i + m - 1 + 32 <= n; i += 32) {
+                __m256i a = lower32(_mm256_loadu_si256((__m256i const *)(s + i)));
+                __m256i b = lower32(_mm256_loadu_si256((__m256i const *)(s + i + m - 1)));
+                uint32_t mask = _mm256_movemask_epi8(
+                        _mm256_and_si256(
+                                _mm256_cmpeq_epi8(a, first),
+                                _mm256_cmpeq_epi8(b, last)
+                        )
+                );
+                while (mask != 0) {
+                        int j = __builtin_ctz(mask);
+                        if (equal(s + i + j, needle, m))
+                                return s + i + j;
+                        mask &= mask - 1;
+                }
+        }
+#elif defined(__SSE2__)
+        __m128i first = _mm_set1_epi8(lower(needle[0]));
+        __m128i last = _mm_set1_epi8(lower(needle[m - 1]));
+
+        for (; i + m - 1 + 16 <= n; i += 16) {
+                __m128i a = lower16(_mm_loadu_si128((__m128i const *)(s + i)));
+                __m128i b = lower16(_mm_loadu_si128((__m128i const *)(s + i + m - 1)));
+                unsigned mask = _mm_movemask_epi8(
+                        _mm_and_si128(
+                                _mm_cmpeq_epi8(a, first),
+                                _mm_cmpeq_epi8(b, last)
+                        )
+                );
+                while (mask != 0) {
+                        int j = __builtin_ctz(mask);
+                        if (equal(s + i + j, needle, m))
+                                return s + i + j;
+                        mask &= mask - 1;
+                }
+        }
+#endif
+
+        unsigned char c = lower(needle[0]);
+
+        for (; i + m <= n; ++i)
+                if (lower(s[i]) == c && equal(s + i, needle, m))
+                        return s + i;
+
+        return NULL;
+}
+
+/*
+ * Myers' bit-parallel edit distance (J. ACM 46(3), 1999), in its search
+ * form: the pattern may start anywhere in `s`. Each bit of pv/mv holds the
+ * vertical delta of one row of the DP matrix, so a whole column is updated
+ * with a handful of word operations per byte of text. Returns the smallest
+ * distance at any end position and stores the span of that match in `r`.
+ */
+static int
+myers(Query const *q, char const *s, struct re_result *r)
+{
+        uint64_t pv = ~(uint64_t)0;
+        uint64_t mv = 0;
+        uint64_t top = (uint64_t)1 << (q->m - 1);
+        int score = q->m;
+        int best = q->m;
+        char const *end = s;
+        char const *begin = s;
+
+        for (; *s != '\0' && best != 0; ++s) {
+                uint64_t eq = q->peq[(unsigned char)*s];
+                uint64_t xv = eq | mv;
+                uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+                uint64_t ph = mv | ~(xh | pv);
+                uint64_t mh = pv & xh;
+
+                if (ph & top)
+                        score += 1;
+                else if (mh & top)
+                        score -= 1;
+
+                ph <<= 1;
+                mh <<= 1;
+                pv = mh | ~(xv | ph);
+                mv = ph & xv;
+
+                if (score < best) {
+                        best = score;
+                        end = s + 1;
+                }
+        }
+
+        r->end = end;
+        r->start = (end - begin > q->m) ? end - q->m : begin;
+
+        return best;
+}
+
+/* drop the ranking, keeping the memory for the next one */
+static void
+forget(Query *q)
+{
+        for (int d = 0; d < QUERY_DISTANCES; ++d)
+                q->hits[d].count = 0;
+        q->ranked = 0;
+        q->scanned = 0;
+}
+
+void
+query_init(Query *q)
+{
+        vec_init(q->text);
+        vec_push(q->text, '\0');
+        for (int d = 0; d < QUERY_DISTANCES; ++d)
+                vec_init(q->hits[d]);
+        q->ranked = 0;
+        q->re = NULL;
+        q->regex = false;
+        q->bad = false;
+        q->fuzzy = 0;
+        q->m = 0;
+        q->source = NULL;
+        q->scanned = 0;
+}
+
+bool
+query_set(Query *q, char const *s, size_t n)
+{
+        if (n + 1 == q->text.count && memcmp(q->text.items, s, n) == 0)
+                return false;
+
+        q->text.count = 0;
+        vec_push_n(q->text, s, n);
+        vec_push(q->text, '\0');
+
+        if (q->re != NULL) {
+                re_free(q->re);
+                q->re = NULL;
+        }
+
+        q->regex = (s[0] == '/');
+        q->bad = false;
+        q->fuzzy = 0;
+
+        forget(q);
+        q->source = NULL;
+
+        if (s[0] == '~') {
+                while (q->fuzzy < n && s[q->fuzzy] == '~')
+                        ++q->fuzzy;
+
+                /* one word's worth of pattern is plenty for a search bar */
+                q->m = n - q->fuzzy;
+                if (q->m > 64)
+                        q->m = 64;
+
+                memset(q->peq, 0, sizeof q->peq);
+                for (int i = 0; i < q->m; ++i) {
+                        unsigned char c = s[q->fuzzy + i];
+                        q->peq[c] |= (uint64_t)1 << i;
+                        if (lower(c) != c)
+                                q->peq[lower(c)] |= (uint64_t)1 << i;
+                        else if (c - 'a' < 26u)
+                                q->peq[c & ~0x20] |= (uint64_t)1 << i;
+                }
+
+                return true;
+        }
+
+        if (!q->regex)
+                return true;
+
+        /* the closing slash is optional so that we can match as the user types */
+        static vec(char) pattern;
+        pattern.count = 0;
+        vec_push_n(pattern, s + 1, n - 1);
+        if (pattern.count != 0 && pattern.items[pattern.count - 1] == '/')
+                --pattern.count;
+        vec_push(pattern, '\0');
+
+        /* an empty pattern matches everything */
+        if (pattern.count == 1)
+                return true;
+
+        q->re = re_compile(pattern.items);
+        q->bad = (q->re == NULL);
+
+        return true;
+}
+
+int
+query_distance(Query const *q, char const *s, struct re_result *r)
+{
+        struct re_result dummy;
+        if (r == NULL)
+                r = &dummy;
+
+        if (q->fuzzy) {
+                if (q->m == 0) {
+                        r->start = r->end = s;
+                        return 0;
+                }
+                /* with k >= m every string would match, which is useless */
+                int k = (q->fuzzy < q->m) ? q->fuzzy : q->m - 1;
+                int d = myers(q, s, r);
+                return (d <= k) ? d : -1;
+        }
+
+        if (q->regex) {
+                if (q->bad)
+                        return -1;
+                if (q->re == NULL) {
+                        r->start = r->end = s;
+                        return 0;
+                }
+                return re_match(q->re, s, r) ? 0 : -1;
+        }
+
+        size_t m = q->text.count - 1;
+        char const *p = search_icase(s, strlen(s), q->text.items, m);
+        if (p == NULL)
+                return -1;
+
+        r->start = p;
+        r->end = p + m;
+
+        return 0;
+}
+
+bool
+query_match(Query const *q, char const *s, struct re_result *r)
+{
+        return query_distance(q, s, r) != -1;
+}
+
+int
+query_message(Query const *q, Message const *m)
+{
+        int d = query_distance(q, m->body, NULL);
+        int t = query_distance(q, m->title, NULL);
+
+        if (d == -1 || (t != -1 && t < d))
+                return t;
+
+        return d;
+}
+
+void
+query_rank(Query *q, void const *source, Message *const *messages, size_t count)
+{
+        if (q->source != source || q->scanned > count) {
+                forget(q);
+                q->source = source;
+        }
+
+        /*
+         * Only messages that arrived since the last call need to be scored,
+         * and each is newer than everything ranked so far, so it's simply
+         * appended to the list for its distance.
+         */
+        for (size_t i = q->scanned; i < count; ++i) {
+                int d = query_message(q, messages[i]);
+                if (d == -1)
+                        continue;
+
+                vec_push(q->hits[d], i);
+                ++q->ranked;
+        }
+
+        q->scanned = count;
+}
+
+size_t
+query_hit(Query const *q, size_t i)
+{
+        int d = 0;
+
+        while (i >= q->hits[d].count)
+                i -= q->hits[d++].count;
+
+        /* newest first */
+        return q->hits[d].items[q->hits[d].count - 1 - i];
+}
+
+void
+query_free(Query *q)
+{
+        if (q->re != NULL)
+                re_free(q->re);
+        vec_empty(q->text);
+        for (int d = 0; d < QUERY_DISTANCES; ++d)
+                vec_empty(q->hits[d]);
+}
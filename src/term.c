@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "alloc.h"
 #include "vec.h"
@@ -12,24 +13,17 @@
 #include "utf8.h"
 #include "log.h"
 
-#define CELL(t, y, x) ((t)->buffers[(t)->i][(t)->cols * (y) + (x)])
-#define ALT_CELL(t, y, x) ((t)->buffers[!(t)->i][(t)->cols * (y) + (x)])
+/* the right half of a wide glyph */
+#define CONTINUATION UINT32_MAX
 
-static Cell const EMPTY;
+/* fewest changed rows worth trying to scroll */
+#define MIN_SCROLL 3
 
-inline static void
-flush(Term *t)
-{
-        char const *output = t->buffer.items;
+/* unchanged cells we'll repaint to avoid moving the cursor */
+#define MAX_GAP 3
 
-        while (t->buffer.count != 0) {
-                int n = write(STDOUT_FILENO, output, t->buffer.count);
-                if (n == -1)
-                        continue;
-                output += n;
-                t->buffer.count -= n;
-        }
-}
+#define CELL(t, y, x) ((t)->buffers[0][(t)->cols * (y) + (x)])
+#define ALT_CELL(t, y, x) ((t)->buffers[1][(t)->cols * (y) + (x)])
 
 inline static bool
 color_equal(Color a, Color b)
@@ -50,20 +44,147 @@ video_equal(Video a, Video b)
             && a.italic == b.italic;
 }
 
+static Cell const EMPTY;
+
+/*
+ * Once either table gets this big, it's thrown away at the start of the
+ * next frame (costing one full repaint) so that it can't grow forever.
+ */
+#define MAX_GLYPHS (1 << 16)
+#define MAX_STYLES (1 << 15)
+
+struct intern {
+        vec(char) bytes;        /* multibyte glyphs, NUL-terminated */
+        vec(uint32_t) glyphs;   /* glyph - 128 -> offset into bytes */
+        vec(Video) styles;
+        vec(uint32_t) gslots;   /* open addressing: glyph + 1, or 0 if free */
+        vec(uint32_t) sslots;   /* style + 1, or 0 if free */
+};
+
+inline static uint32_t
+hash(char const *s, size_t n)
+{
+        uint32_t h = 5381;
+
+        for (size_t i = 0; i < n; ++i)
+                h = (h << 5) + h + (unsigned char)s[i];
+
+        return h;
+}
+
+inline static uint32_t
+video_hash(Video v)
+{
+        unsigned char k[7] = {
+                v.fg.r, v.fg.g, v.fg.b,
+                v.bg.r, v.bg.g, v.bg.b,
+                v.reverse | v.bold << 1 | v.underline << 2 | v.italic << 3
+        };
+
+        return hash((char const *)k, sizeof k);
+}
+
+inline static char const *
+glyph_data(struct intern const *in, uint32_t g)
+{
+        return in->bytes.items + in->glyphs.items[g - 128];
+}
+
+static void
+rehash(struct intern *in)
+{
+        size_t gsz = 64;
+        size_t ssz = 64;
+
+        while (gsz < 2 * in->glyphs.count)
+                gsz *= 2;
+        while (ssz < 2 * in->styles.count)
+                ssz *= 2;
+
+        in->gslots.count = 0;
+        in->sslots.count = 0;
+        vec_reserve(in->gslots, gsz);
+        vec_reserve(in->sslots, ssz);
+        in->gslots.count = gsz;
+        in->sslots.count = ssz;
+        memset(in->gslots.items, 0, gsz * sizeof (uint32_t));
+        memset(in->sslots.items, 0, ssz * sizeof (uint32_t));
+
+        for (uint32_t g = 0; g < in->glyphs.count; ++g) {
+                char const *d = glyph_data(in, g + 128);
+                size_t i = hash(d, strlen(d)) & (gsz - 1);
+                while (in->gslots.items[i] != 0)
+                        i = (i + 1) & (gsz - 1);
+                in->gslots.items[i] = g + 1;
+        }
+
+        for (uint32_t st = 0; st < in->styles.count; ++st) {
+                size_t i = video_hash(in->styles.items[st]) & (ssz - 1);
+                while (in->sslots.items[i] != 0)
+                        i = (i + 1) & (ssz - 1);
+                in->sslots.items[i] = st + 1;
+        }
+}
+
+static uint32_t
+intern_glyph(struct intern *in, char const *s, int n)
+{
+        if (n == 1 && (unsigned char)s[0] < 128)
+                return (unsigned char)s[0];
+
+        if (2 * in->glyphs.count >= in->gslots.count)
+                rehash(in);
+
+        size_t mask = in->gslots.count - 1;
+        size_t i = hash(s, n) & mask;
+
+        for (uint32_t g; (g = in->gslots.items[i]) != 0; i = (i + 1) & mask) {
+                char const *d = glyph_data(in, g - 1 + 128);
+                if (strncmp(d, s, n) == 0 && d[n] == '\0')
+                        return g - 1 + 128;
+        }
+
+        in->gslots.items[i] = in->glyphs.count + 1;
+        vec_push(in->glyphs, in->bytes.count);
+        vec_push_n(in->bytes, s, n);
+        vec_push(in->bytes, '\0');
+
+        return in->glyphs.count - 1 + 128;
+}
+
+static uint16_t
+intern_style(struct intern *in, Video v)
+{
+        if (2 * in->styles.count >= in->sslots.count)
+                rehash(in);
+
+        size_t mask = in->sslots.count - 1;
+        size_t i = video_hash(v) & mask;
+
+        for (uint32_t st; (st = in->sslots.items[i]) != 0; i = (i + 1) & mask)
+                if (video_equal(in->styles.items[st - 1], v))
+                        return st - 1;
+
+        /* only possible mid-frame; the table is reset before the next one */
+        if (in->styles.count > UINT16_MAX)
+                return 0;
+
+        in->sslots.items[i] = in->styles.count + 1;
+        vec_push(in->styles, v);
+
+        return in->styles.count - 1;
+}
+
 inline static bool
 cell_empty(Cell const *c)
 {
-        return c->data[0] == '\0';
+        return c->glyph == 0;
 }
 
 inline static bool
 cell_equal(Cell const *a, Cell const *b)
 {
-        if (cell_empty(a) && cell_empty(b))
-                return true;
-
-        return video_equal(a->video, b->video)
-            && strcmp(a->data, b->data) == 0;
+        return memcmp(a, b, sizeof *a) == 0;
 }
 
 inline static void
@@ -73,109 +194,647 @@ render(Term *t, char const *s)
 }
 
 inline static void
-render_forward(Term *t, int n)
+render_glyph(Term *t, uint32_t g)
 {
-        char buffer[64];
-        snprintf(buffer, sizeof buffer, "\033[%dC", n);
-        render(t, buffer);
+        if (g < 128)
+                vec_push(t->buffer, g);
+        else
+                render(t, glyph_data(t->intern, g));
 }
 
-inline static void
-render_video(Term *t)
+/* the colours we actually use for C_DEFAULT */
+inline static Color
+real_fg(Color c)
 {
-        char buffer[128];
+        return color_equal(c, C_DEFAULT) ? (Color) { 220, 220, 220 } : c;
+}
 
-        Video v = t->video;
-        Color fg = v.fg;
-        Color bg = v.bg;
+inline static Color
+real_bg(Color c)
+{
+        return color_equal(c, C_DEFAULT) ? (Color) { 20, 20, 20 } : c;
+}
 
-        if (color_equal(fg, C_DEFAULT))
-                fg = (Color) { 220, 220, 220 };
+/* index of `c` in the xterm 256-colour palette, or -1 if it isn't there exactly */
+static int
+palette_index(Color c)
+{
+        static int const level[256] = {
+                [0] = 1, [95] = 2, [135] = 3, [175] = 4, [215] = 5, [255] = 6
+        };
 
-        if (color_equal(bg, C_DEFAULT))
-                bg = (Color) { 20, 20, 20 };
+        if (level[c.r] && level[c.g] && level[c.b])
+                return 16 + 36 * (level[c.r] - 1) + 6 * (level[c.g] - 1) + (level[c.b] - 1);
 
-        int n = sprintf(buffer, "\033[0;");
+        if (c.r == c.g && c.g == c.b && c.r >= 8 && c.r <= 238 && (c.r - 8) % 10 == 0)
+                return 232 + (c.r - 8) / 10;
 
-        if (v.bold)      n += sprintf(buffer + n, "1;");
-        if (v.italic)    n += sprintf(buffer + n, "3;");
-        if (v.underline) n += sprintf(buffer + n, "4;");
-        if (v.reverse)   n += sprintf(buffer + n, "7;");
+        return -1;
+}
 
-        n += sprintf(
-                buffer + n,
-                "38;2;%"PRIu8";%"PRIu8";%"PRIu8";",
-                fg.r, fg.g, fg.b
-        );
+/* xterm's defaults for the 16 colours most terminals let users redefine */
+static Color const ansi[16] = {
+        {   0,   0,   0 }, { 205,   0,   0 }, {   0, 205,   0 }, { 205, 205,   0 },
+        {   0,   0, 238 }, { 205,   0, 205 }, {   0, 205, 205 }, { 229, 229, 229 },
+        { 127, 127, 127 }, { 255,   0,   0 }, {   0, 255,   0 }, { 255, 255,   0 },
+        {  92,  92, 255 }, { 255,   0, 255 }, {   0, 255, 255 }, { 255, 255, 255 }
+};
+
+/* nearest palette entry for each colour, indexed by its top 5 bits per channel */
+static uint8_t lut256[1 << 15];
+static uint8_t lut16[1 << 15];
+
+inline static int
+distance(Color a, Color b)
+{
+        int dr = a.r - b.r;
+        int dg = a.g - b.g;
+        int db = a.b - b.b;
+
+        /* weighted for the eye's sensitivity to green */
+        return 2 * dr * dr + 4 * dg * dg + 3 * db * db;
+}
+
+inline static int
+rgb15(Color c)
+{
+        return (c.r >> 3) << 10 | (c.g >> 3) << 5 | (c.b >> 3);
+}
+
+static void
+build_luts(void)
+{
+        static int const level[6] = { 0, 95, 135, 175, 215, 255 };
+
+        for (int i = 0; i < (1 << 15); ++i) {
+                Color c = {
+                        ((i >> 10) & 31) << 3 | 4,
+                        ((i >> 5) & 31) << 3 | 4,
+                        (i & 31) << 3 | 4
+                };
+
+                /* the cube is separable, so the nearest level for each channel will do */
+                int q[3];
+                uint8_t const *ch = &c.r;
+                for (int k = 0; k < 3; ++k) {
+                        q[k] = 0;
+                        for (int l = 1; l < 6; ++l)
+                                if (abs(ch[k] - level[l]) < abs(ch[k] - level[q[k]]))
+                                        q[k] = l;
+                }
 
-        n += sprintf(
-                buffer + n,
-                "48;2;%"PRIu8";%"PRIu8";%"PRIu8";",
-                bg.r, bg.g, bg.b
+                Color cube = { level[q[0]], level[q[1]], level[q[2]] };
+                int best = 16 + 36 * q[0] + 6 * q[1] + q[2];
+
+                /* the grey that's nearest under distance() is at the weighted mean */
+                int y = (2 * c.r + 4 * c.g + 3 * c.b) / 9;
+                int g = (y < 8) ? 0 : (y > 238) ? 23 : (y - 8 + 5) / 10;
+                if (g > 23)
+                        g = 23;
+                Color gray = { 8 + 10 * g, 8 + 10 * g, 8 + 10 * g };
+                if (distance(c, gray) < distance(c, cube))
+                        best = 232 + g;
+
+                lut256[i] = best;
+
+                int near = 0;
+                for (int k = 1; k < 16; ++k)
+                        if (distance(c, ansi[k]) < distance(c, ansi[near]))
+                                near = k;
+
+                lut16[i] = near;
+        }
+}
+
+/* append "38;..." (or "48;...") for `c` to `buffer`, in the shortest form the terminal takes */
+static int
+sgr_color(Term const *t, char *buffer, int base, Color c, bool dflt)
+{
+        static bool ready = false;
+
+        if (t->colors != TC_TRUE && !ready) {
+                build_luts();
+                ready = true;
+        }
+
+        int i = palette_index(c);
+
+        switch (t->colors) {
+        case TC_16:
+                /* let the terminal's own theme have the default colours */
+                if (dflt)
+                        return sprintf(buffer, "%d;", base + 1);
+                i = lut16[rgb15(c)];
+                return sprintf(buffer, "%d;", (i < 8) ? base - 8 + i : base + 52 + i - 8);
+        case TC_256:
+                if (i == -1)
+                        i = lut256[rgb15(c)];
+                /* fall through */
+        case TC_TRUE:
+                if (i != -1)
+                        return sprintf(buffer, "%d;5;%d;", base, i);
+        }
+
+        return sprintf(
+                buffer,
+                "%d;2;%"PRIu8";%"PRIu8";%"PRIu8";",
+                base,
+                c.r, c.g, c.b
         );
+}
+
+/*
+ * Switch the terminal from t->video to `v`. Unless we don't know what the
+ * terminal is using, only the attributes that differ are sent, or a reset
+ * followed by the rest when that comes out shorter.
+ */
+static void
+render_video(Term *t, Video v)
+{
+        char full[128];
+        char delta[128];
+
+        Video o = t->video;
+        Color fg = real_fg(v.fg);
+        Color bg = real_bg(v.bg);
+
+        int n = sprintf(full, "\033[0;");
+
+        if (v.bold)      n += sprintf(full + n, "1;");
+        if (v.italic)    n += sprintf(full + n, "3;");
+        if (v.underline) n += sprintf(full + n, "4;");
+        if (v.reverse)   n += sprintf(full + n, "7;");
+
+        n += sgr_color(t, full + n, 38, fg, color_equal(v.fg, C_DEFAULT));
+        n += sgr_color(t, full + n, 48, bg, color_equal(v.bg, C_DEFAULT));
+
+        full[n - 1] = 'm';
+
+        char const *out = full;
+
+        if (t->synced) {
+                int d = sprintf(delta, "\033[");
+
+                if (o.bold != v.bold)           d += sprintf(delta + d, v.bold ? "1;" : "22;");
+                if (o.italic != v.italic)       d += sprintf(delta + d, v.italic ? "3;" : "23;");
+                if (o.underline != v.underline) d += sprintf(delta + d, v.underline ? "4;" : "24;");
+                if (o.reverse != v.reverse)     d += sprintf(delta + d, v.reverse ? "7;" : "27;");
+
+                /* colours that differ can still come out the same on this terminal */
+                char was[32];
+                char now[32];
+
+                sgr_color(t, was, 38, real_fg(o.fg), color_equal(o.fg, C_DEFAULT));
+                sgr_color(t, now, 38, fg, color_equal(v.fg, C_DEFAULT));
+                if (strcmp(was, now) != 0)
+                        d += sprintf(delta + d, "%s", now);
+
+                sgr_color(t, was, 48, real_bg(o.bg), color_equal(o.bg, C_DEFAULT));
+                sgr_color(t, now, 48, bg, color_equal(v.bg, C_DEFAULT));
+                if (strcmp(was, now) != 0)
+                        d += sprintf(delta + d, "%s", now);
+
+                /* nothing that the terminal would notice */
+                if (d == 2) {
+                        t->video = v;
+                        return;
+                }
+
+                delta[d - 1] = 'm';
+
+                if (d < n) {
+                        out = delta;
+                        n = d;
+                }
+        }
+
+        vec_push_n(t->buffer, out, n);
+
+        t->video = v;
+        t->synced = true;
+}
+
+inline static bool
+cell_changed(Term const *t, int y, int x)
+{
+        return !cell_equal(&CELL(t, y, x), &ALT_CELL(t, y, x));
+}
+
+/*
+ * Bytes it takes to reach column `to` from column `from` on row `y` by
+ * writing out what's already on the screen there, or -1 if we can't: every
+ * cell must be unchanged, non-empty, and in the video the terminal is using.
+ */
+static int
+rewrite_cost(Term const *t, int y, int from, int to, int limit)
+{
+        int cost = 0;
+
+        if (!t->synced || CELL(t, y, from).glyph == CONTINUATION)
+                return -1;
+
+        for (int x = from; x < to; ++x) {
+                Cell const *c = &CELL(t, y, x);
+
+                if (c->glyph == CONTINUATION)
+                        continue;
+
+                if (cell_empty(c) || cell_changed(t, y, x) || x + c->width > to)
+                        return -1;
 
-        buffer[n - 1] = 'm';
+                if (!video_equal(t->intern->styles.items[c->style], t->video))
+                        return -1;
 
-        vec_push_n(t->buffer, buffer, n);
+                cost += (c->glyph < 128) ? 1 : strlen(glyph_data(t->intern, c->glyph));
+                if (cost > limit)
+                        return -1;
+        }
+
+        return cost;
 }
 
+/* a way of moving the cursor, see render_move() */
+struct motion {
+        char seq[64];
+        int cost;       /* in bytes, counting any rewritten cells */
+        int rewrite;    /* after seq, rewrite the cells from here to the target, or -1 */
+};
+
+/* try going from column `from` to `to` on row `y` with relative moves, after `prefix` */
+static void
+relative(Term const *t, int y, int from, int to, char const *prefix, struct motion *best)
+{
+        struct motion m = { .rewrite = -1 };
+        int n = sprintf(m.seq, "%s", prefix);
+
+        if (from < to) {
+                int cost = rewrite_cost(t, y, from, to, best->cost - n - 1);
+                if (cost != -1) {
+                        m.cost = n + cost;
+                        m.rewrite = from;
+                } else if (to - from == 1) {
+                        m.cost = n + sprintf(m.seq + n, "\033[C");
+                } else {
+                        m.cost = n + sprintf(m.seq + n, "\033[%dC", to - from);
+                }
+        } else if (from - to > 3) {
+                m.cost = n + sprintf(m.seq + n, "\033[%dD", from - to);
+        } else {
+                memset(m.seq + n, '\b', from - to);
+                m.cost = n + (from - to);
+                m.seq[m.cost] = '\0';
+        }
+
+        if (m.cost < best->cost)
+                *best = m;
+}
+
+/*
+ * Move the cursor the cheapest way we know of, a bit like curses' mvcur():
+ * CUP, or any vertical move followed by CHA, CR, CUF/CUB, backspaces, or
+ * by writing out again whatever is on the screen up to the target. We never
+ * use LF, since the tty might turn it into CR LF.
+ */
 inline static void
 render_move(Term *t, int y, int x)
 {
-        char buffer[64];
-        sprintf(buffer, "\033[%d;%dH", y + 1, x + 1);
-        render(t, buffer);
+        struct motion best = { .rewrite = -1 };
+
+        if (t->cursor.y == y && t->cursor.x == x)
+                return;
+
+        if (y == 0 && x == 0)
+                best.cost = sprintf(best.seq, "\033[H");
+        else if (x == 0)
+                best.cost = sprintf(best.seq, "\033[%dH", y + 1);
+        else
+                best.cost = sprintf(best.seq, "\033[%d;%dH", y + 1, x + 1);
+
+        if (t->cursor.y != -1) {
+                char v[16] = "";
+                char alt[16];
+                int dy = y - t->cursor.y;
+
+                if (dy != 0) {
+                        if (dy == -1)     sprintf(v, "\033[A");
+                        else if (dy == 1) sprintf(v, "\033[B");
+                        else if (dy < 0)  sprintf(v, "\033[%dA", -dy);
+                        else              sprintf(v, "\033[%dB", dy);
+                        sprintf(alt, "\033[%dd", y + 1);
+                        if (strlen(alt) < strlen(v))
+                                strcpy(v, alt);
+                }
+
+                char prefix[32];
+
+                if (t->cursor.x != -1)
+                        relative(t, y, t->cursor.x, x, v, &best);
+
+                snprintf(prefix, sizeof prefix, "%s\r", v);
+                relative(t, y, 0, x, prefix, &best);
+
+                if (x == 0)
+                        snprintf(prefix, sizeof prefix, "%s\033[G", v);
+                else
+                        snprintf(prefix, sizeof prefix, "%s\033[%dG", v, x + 1);
+                relative(t, y, x, x, prefix, &best);
+        }
+
+        render(t, best.seq);
+
+        if (best.rewrite != -1) {
+                for (int i = best.rewrite; i < x; ++i) {
+                        uint32_t g = CELL(t, y, i).glyph;
+                        if (g != CONTINUATION)
+                                render_glyph(t, g);
+                }
+        }
+
+        t->cursor.y = y;
+        t->cursor.x = x;
 }
 
-inline static int
-skip_empty(Term * const t, int y, int x)
+inline static void
+render_style(Term *t, Video v)
+{
+        if (!t->synced || !video_equal(t->video, v))
+                render_video(t, v);
+}
+
+/*
+ * Paint cells [x, end) of row `y`. Past `last` the row is blank, which we
+ * leave to EL. If `erased` is set the screen is already blank here, so empty
+ * cells can be skipped rather than overwritten.
+ */
+static void
+render_cells(Term *t, int y, int x, int end, int last, bool erased)
 {
-        int n = 0;
+        render_move(t, y, x);
+
+        while (x < end) {
+                Cell const *c = &CELL(t, y, x);
+
+                if (x >= last) {
+                        if (!erased) {
+                                render_style(t, V_NORMAL);
+                                render(t, "\033[K");
+                        }
+                        return;
+                }
+
+                if (cell_empty(c)) {
+                        if (erased) {
+                                while (cell_empty(&CELL(t, y, x)))
+                                        ++x;
+                                if (x >= end)
+                                        return;
+                                render_move(t, y, x);
+                        } else {
+                                render_style(t, V_NORMAL);
+                                render(t, " ");
+                                x += 1;
+                                t->cursor.x += 1;
+                        }
+                        continue;
+                }
+
+                render_style(t, t->intern->styles.items[c->style]);
+                render_glyph(t, c->glyph);
+                x += c->width;
+                t->cursor.x += c->width;
+        }
+
+        /* the cursor doesn't move past the last column, it waits to wrap */
+        if (t->cursor.x >= t->cols)
+                t->cursor.x = -1;
+}
+
+/* returns false if the row is as it was; `force` redraws it whatever it was */
+static bool
+render_line(Term *t, int y, bool force)
+{
+        Dirty const *d = &t->dirty[y];
+        int ink = t->ink[0][y];
+        int alt = t->ink[1][y];
+
+        int last = t->cols;
+        while (last > 0 && cell_empty(&CELL(t, y, last - 1)))
+                --last;
+
+        if (force) {
+                render_move(t, y, 0);
+                render_style(t, V_NORMAL);
+                render(t, "\033[2K");
+                render_cells(t, y, 0, last, last, true);
+                return true;
+        }
 
-        while (x + n < t->cols && cell_empty(&CELL(t, y, x + n)))
-                ++n;
+        /* every non-empty cell is where it was last frame */
+        if (d->same == ink && ink == alt)
+                return false;
 
-        return n;
+        /* if nothing disappeared, only the written span can differ */
+        int x = (d->same == alt) ? d->lo : 0;
+        int end = (d->same == alt) ? d->hi : t->cols;
+
+        while (x < end) {
+                while (x < end && !cell_changed(t, y, x))
+                        ++x;
+                if (x == end)
+                        break;
+
+                /* never start halfway through a wide glyph */
+                int start = x;
+                if (CELL(t, y, start).glyph == CONTINUATION)
+                        --start;
+
+                /* a short run of unchanged cells is cheaper to repaint than to jump over */
+                int stop = x;
+                for (int gap = 0; x < end && gap <= MAX_GAP; ++x) {
+                        if (cell_changed(t, y, x)) {
+                                stop = x + 1;
+                                gap = 0;
+                        } else {
+                                gap += 1;
+                        }
+                }
+                x = stop;
+
+                if (x < t->cols && CELL(t, y, x).glyph == CONTINUATION)
+                        ++x;
+
+                render_cells(t, y, start, x, last, false);
+
+                /* that ended with an EL, which took care of the rest */
+                if (x > last)
+                        break;
+        }
+
+        return true;
+}
+
+/* for when the frame is either blank or the same as the screen */
+inline static void
+reset_dirty(Term *t)
+{
+        for (int y = 0; y < t->rows; ++y) {
+                t->dirty[y].lo = t->cols;
+                t->dirty[y].hi = 0;
+                t->dirty[y].same = t->ink[0][y];
+        }
+}
+
+/* rebuild row `y`'s Dirty from scratch, for when the screen under it changed */
+static void
+recount(Term *t, int y)
+{
+        Dirty *d = &t->dirty[y];
+
+        d->lo = t->cols;
+        d->hi = 0;
+        d->same = 0;
+
+        for (int x = 0; x < t->cols; ++x) {
+                if (cell_changed(t, y, x)) {
+                        if (x < d->lo) d->lo = x;
+                        d->hi = x + 1;
+                } else if (!cell_empty(&CELL(t, y, x))) {
+                        d->same += 1;
+                }
+        }
 }
 
-/* did row `y` change since last redraw? */
 inline static bool
-changed(Term const *t, int y)
+row_clean(Term const *t, int y)
+{
+        int ink = t->ink[0][y];
+        return t->dirty[y].same == ink && ink == t->ink[1][y];
+}
+
+inline static uint64_t
+row_hash(Cell const *row, int n)
 {
-        for (int x = 0; x < t->cols; ++x)
-                if (!cell_equal(&CELL(t, y, x), &ALT_CELL(t, y, x)))
-                        return true;
-        return false;
+        uint64_t h = 0xcbf29ce484222325;
+
+        for (int x = 0; x < n; ++x) {
+                uint64_t c;
+                memcpy(&c, &row[x], sizeof c);
+                h = (h ^ c) * 0x100000001b3;
+        }
+
+        return h;
 }
 
+/*
+ * When text in a full-width region moved up or down by a few rows since
+ * the last frame (a new message in a busy channel, say), have the terminal
+ * move it for us with a scroll region, and let render_line() take care of
+ * whatever is left.
+ */
 static void
-render_line(Term *t, int y)
+scroll(Term *t)
 {
-        if (!t->force && !changed(t, y))
+        static vec(uint64_t) now;
+        static vec(uint64_t) then;
+
+        int dirty = 0;
+        for (int y = 0; y < t->rows; ++y)
+                dirty += !row_clean(t, y);
+
+        if (dirty < MIN_SCROLL)
                 return;
 
-        if (!video_equal(t->video, V_NORMAL)) {
-                t->video = V_NORMAL;
-                render_video(t);
+        now.count = then.count = 0;
+        vec_reserve(now, t->rows);
+        vec_reserve(then, t->rows);
+
+        for (int y = 0; y < t->rows; ++y) {
+                now.items[y] = row_hash(&CELL(t, y, 0), t->cols);
+                then.items[y] = row_hash(&ALT_CELL(t, y, 0), t->cols);
         }
 
-        render_move(t, y, 0);
-        render(t, "\033[2K");
+        /* find the shift that fixes the most rows: row y shows what row y + shift did */
+        int best = 0;
+        int shift = 0;
+        int top = 0;
+        int bottom = 0;
 
-        int x = 0;
+        for (int k = 1 - t->rows; k < t->rows; ++k) {
+                if (k == 0)
+                        continue;
 
-        for (;;) {
-                int skip = skip_empty(t, y, x);
-                if (x + skip == t->cols)
-                        break;
-                if (skip > 0)
-                        render_forward(t, skip);
-                x += skip;
-                t->video = CELL(t, y, x).video;
-                render_video(t);
-                while (x < t->cols && video_equal(CELL(t, y, x).video, t->video))
-                        render(t, CELL(t, y, x++).data);
+                int lo = (k < 0) ? -k : 0;
+                int hi = (k > 0) ? t->rows - k : t->rows;
+
+                for (int y = lo; y < hi;) {
+                        if (t->ink[0][y] == 0 || now.items[y] != then.items[y + k]) {
+                                ++y;
+                                continue;
+                        }
+
+                        int start = y;
+                        int gain = 0;
+                        for (; y < hi && t->ink[0][y] != 0 && now.items[y] == then.items[y + k]; ++y)
+                                gain += (now.items[y] != then.items[y]);
+
+                        if (gain > best) {
+                                best = gain;
+                                shift = k;
+                                top = start;
+                                bottom = y;
+                        }
+                }
         }
+
+        if (best < MIN_SCROLL)
+                return;
+
+        /* the rows [top, bottom) came from [top + shift, bottom + shift) */
+        int first = (shift > 0) ? top : top + shift;
+        int last = (shift > 0) ? bottom + shift : bottom;
+        int n = abs(shift);
+
+        char buffer[64];
+
+        /* the rows scrolled in are filled with the current background */
+        render_style(t, V_NORMAL);
+
+        bool region = (first != 0 || last != t->rows);
+        if (region) {
+                snprintf(buffer, sizeof buffer, "\033[%d;%dr", first + 1, last);
+                render(t, buffer);
+        }
+
+        snprintf(buffer, sizeof buffer, "\033[%d%c", n, (shift > 0) ? 'S' : 'T');
+        render(t, buffer);
+
+        if (region) {
+                render(t, "\033[r");
+                t->cursor.y = 0;
+                t->cursor.x = 0;
+        }
+
+        /* now do the same to our idea of what's on the screen */
+        Cell *screen = t->buffers[1];
+        int *ink = t->ink[1];
+        size_t row = sizeof (Cell[t->cols]);
+        int blank = (shift > 0) ? last - n : first;
+
+        memmove(
+                screen + (first + (shift < 0) * n) * t->cols,
+                screen + (first + (shift > 0) * n) * t->cols,
+                (last - first - n) * row
+        );
+        memmove(
+                ink + first + (shift < 0) * n,
+                ink + first + (shift > 0) * n,
+                (last - first - n) * sizeof *ink
+        );
+        memset(screen + blank * t->cols, 0, n * row);
+        memset(ink + blank, 0, n * sizeof *ink);
+
+        for (int y = first; y < last; ++y)
+                recount(t, y);
 }
 
 void
@@ -185,12 +844,34 @@ term_resize(Term *t, int rows, int cols)
 
         resize(t->buffers[0], size);
         resize(t->buffers[1], size);
+        resize(t->ink[0], rows * sizeof (int));
+        resize(t->ink[1], rows * sizeof (int));
+        resize(t->dirty, rows * sizeof (Dirty));
+
+        if (t->intern == NULL) {
+                t->intern = alloc(sizeof *t->intern);
+                vec_init(t->intern->bytes);
+                vec_init(t->intern->glyphs);
+                vec_init(t->intern->styles);
+                vec_init(t->intern->gslots);
+                vec_init(t->intern->sslots);
+                rehash(t->intern);
+        }
 
         memset(t->buffers[0], 0, size);
         memset(t->buffers[1], 0, size);
+        memset(t->ink[0], 0, rows * sizeof (int));
+        memset(t->ink[1], 0, rows * sizeof (int));
 
         t->rows = rows;
         t->cols = cols;
+
+        t->cursor.y = -1;
+        t->cursor.x = -1;
+
+        term_clip(t, 0, 0, rows, cols);
+
+        reset_dirty(t);
 }
 
 void
@@ -200,11 +881,18 @@ term_init(Term *t, int rows, int cols)
         t->x = 0;
         t->rows = 0;
         t->cols = 0;
-        t->i = 0;
         t->buffers[0] = NULL;
         t->buffers[1] = NULL;
+        t->ink[0] = NULL;
+        t->ink[1] = NULL;
+        t->dirty = NULL;
+        t->intern = NULL;
         t->video = V_NORMAL;
+        t->synced = false;
         vec_init(t->buffer);
+        t->written = 0;
+        t->sink = NULL;
+        t->sink_ctx = NULL;
         term_resize(t, rows, cols);
         /*
          * Clear the screen before the first render so that
@@ -220,17 +908,74 @@ term_move(Term *t, int y, int x)
         t->x = x;
 }
 
+/* store `c` in the current frame, keeping the row's Dirty and ink up to date */
+static void
+put(Term *t, int y, int x, Cell c)
+{
+        Cell *p = &CELL(t, y, x);
+        Cell const *alt = &ALT_CELL(t, y, x);
+        Dirty *d = &t->dirty[y];
+        int *ink = &t->ink[0][y];
+
+        if (!cell_empty(p) && cell_equal(p, alt))
+                d->same -= 1;
+
+        *ink += !cell_empty(&c) - !cell_empty(p);
+        *p = c;
+
+        if (!cell_equal(p, alt)) {
+                if (x < d->lo) d->lo = x;
+                if (x + 1 > d->hi) d->hi = x + 1;
+        } else if (!cell_empty(p)) {
+                d->same += 1;
+        }
+}
+
+/* make sure no wide glyph is left half overwritten by writing to [x, x + w) */
+inline static void
+orphan(Term *t, int y, int x, int w)
+{
+        if (CELL(t, y, x).glyph == CONTINUATION)
+                put(t, y, x - 1, EMPTY);
+
+        if (x + w < t->cols && CELL(t, y, x + w).glyph == CONTINUATION)
+                put(t, y, x + w, EMPTY);
+}
+
 void
 term_write(Term *t, Video v, char const *s)
 {
         int width;
         int i = 0;
 
+        if (t->y < t->clip.y || t->y >= t->clip.y + t->clip.height)
+                return;
+
+        uint16_t style = intern_style(t->intern, v);
+
         while (s[i] != '\0') {
                 int bytes = utf8_next(s + i, &width);
-                memcpy(CELL(t, t->y, t->x).data, s + i, bytes);
-                CELL(t, t->y, t->x).data[bytes] = '\0';
-                CELL(t, t->y, t->x).video = v;
+
+                if (t->x < t->clip.x || t->x + width > t->clip.x + t->clip.width)
+                        break;
+
+                /* nothing we can put in a cell of its own */
+                if (width == 0) {
+                        i += bytes;
+                        continue;
+                }
+
+                orphan(t, t->y, t->x, width);
+
+                put(t, t->y, t->x, (Cell) {
+                        .glyph = intern_glyph(t->intern, s + i, bytes),
+                        .style = style,
+                        .width = width
+                });
+
+                for (int j = 1; j < width; ++j)
+                        put(t, t->y, t->x + j, (Cell) { .glyph = CONTINUATION, .style = style });
+
                 t->x += width;
                 i += bytes;
         }
@@ -270,24 +1015,143 @@ term_mvprintf(Term *t, int y, int x, Video v, char const *fmt, ...)
 void
 term_clear(Term *t)
 {
-        for (int y = 0; y < t->rows; ++y)
-                for (int x = 0; x < t->cols; ++x)
-                        CELL(t, y, x) = EMPTY;
+        struct intern *in = t->intern;
+
+        if (in->glyphs.count > MAX_GLYPHS || in->styles.count > MAX_STYLES) {
+                in->bytes.count = 0;
+                in->glyphs.count = 0;
+                in->styles.count = 0;
+                rehash(in);
+
+                /* the ids on screen no longer mean anything */
+                size_t size = sizeof (Cell[t->rows * t->cols]);
+                memset(t->buffers[1], 0, size);
+                memset(t->ink[1], 0, t->rows * sizeof (int));
+                t->force = true;
+        }
+
+        for (int y = 0; y < t->rows; ++y) {
+                if (t->ink[0][y] != 0) {
+                        memset(&CELL(t, y, 0), 0, sizeof (Cell[t->cols]));
+                        t->ink[0][y] = 0;
+                }
+        }
+
+        reset_dirty(t);
+}
+
+void
+term_erase(Term *t, int y, int x, int height, int width)
+{
+        int top = (y > 0) ? y : 0;
+        int left = (x > 0) ? x : 0;
+        int bottom = (y + height < t->rows) ? y + height : t->rows;
+        int right = (x + width < t->cols) ? x + width : t->cols;
+
+        for (int i = top; i < bottom; ++i) {
+                if (t->ink[0][i] == 0)
+                        continue;
+                for (int j = left; j < right; ++j)
+                        if (!cell_empty(&CELL(t, i, j)))
+                                put(t, i, j, EMPTY);
+        }
+}
+
+void
+term_clip(Term *t, int y, int x, int height, int width)
+{
+        int top = (y > 0) ? y : 0;
+        int left = (x > 0) ? x : 0;
+
+        t->clip.y = top;
+        t->clip.x = left;
+        t->clip.height = ((y + height < t->rows) ? y + height : t->rows) - top;
+        t->clip.width = ((x + width < t->cols) ? x + width : t->cols) - left;
 }
 
 void
 term_flush(Term *t)
 {
-        for (int y = 0; y < t->rows; ++y)
-                render_line(t, y);
-        
-        render_move(t, t->y, t->x);        
-        
-        flush(t);
+        bool force = t->force;
 
-        size_t size = sizeof (Cell[t->rows * t->cols]);
-        memcpy(t->buffers[!t->i], t->buffers[t->i], size);
+        if (!force)
+                scroll(t);
 
-        t->i += 1;
+        /* cleared before anything is written, so that term_drain() can ask for the next frame to start over */
         t->force = false;
+
+        /* bring our copy of the screen up to date as we go */
+        for (int y = 0; y < t->rows; ++y) {
+                if (render_line(t, y, force)) {
+                        memcpy(&ALT_CELL(t, y, 0), &CELL(t, y, 0), sizeof (Cell[t->cols]));
+                        t->ink[1][y] = t->ink[0][y];
+                }
+        }
+
+        render_move(t, t->y, t->x);
+
+        reset_dirty(t);
+
+        /* have the next frame drawn from scratch, so that term_clear() can reset the tables */
+        struct intern *in = t->intern;
+        if (in->glyphs.count > MAX_GLYPHS || in->styles.count > MAX_STYLES)
+                t->force = true;
+
+        term_drain(t);
+}
+
+bool
+term_drain(Term *t)
+{
+        while (t->written < t->buffer.count) {
+                char const *data = t->buffer.items + t->written;
+                size_t size = t->buffer.count - t->written;
+                ssize_t n = (t->sink != NULL)
+                          ? t->sink(t->sink_ctx, data, size)
+                          : write(STDOUT_FILENO, data, size);
+
+                if (n != -1) {
+                        t->written += n;
+                } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        return false;
+                } else if (errno != EINTR) {
+                        /* no telling what made it to the screen, so start over */
+                        t->force = true;
+                        t->cursor.y = t->cursor.x = -1;
+                        t->synced = false;
+                        break;
+                }
+        }
+
+        t->buffer.count = 0;
+        t->written = 0;
+
+        return true;
+}
+
+bool
+term_busy(Term const *t)
+{
+        return t->written < t->buffer.count;
+}
+
+int
+term_guess_colors(void)
+{
+        char const *colorterm = getenv("COLORTERM");
+        char const *term = getenv("TERM");
+
+        if (colorterm != NULL && (strcmp(colorterm, "truecolor") == 0 || strcmp(colorterm, "24bit") == 0))
+                return TC_TRUE;
+
+        if (term == NULL)
+                return TC_TRUE;
+
+        if (strstr(term, "direct") != NULL)
+                return TC_TRUE;
+
+        if (strstr(term, "256color") != NULL)
+                return TC_256;
+
+        return TC_16;
 }
@@ -7,7 +7,6 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <unistd.h>
-#include <signal.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <limits.h>
@@ -15,6 +14,8 @@
 #include <assert.h>
 #include <sys/ioctl.h>
 #include <termios.h>
+#include <poll.h>
+#include <pthread.h>
 #include <libsrsirc/irc_track.h>
 #include <libsrsirc/irc_ext.h>
 #include <libsrsirc/util.h>
@@ -23,11 +24,16 @@
 #include "util.h"
 #include "log.h"
 #include "term.h"
+#include "search.h"
+#include "gsearch.h"
 
 #define MAX_NICK    15
 #define TIME_LEN    8
 #define LEFT_MARGIN (MAX_NICK + TIME_LEN + 1 + 3)
 
+/* lag is shown in the status line from this many ms */
+#define LAG_SHOWN   1000
+
 static Term term;
 static Window *root;
 
@@ -73,6 +79,10 @@ ui_nick_color(char const *nick)
         for (int i = 0; nick[i] != '\0'; ++i)
                 hash = (hash << 5) + hash + nick[i];
         
+        /* the networks' threads color nicks too, and rand() is shared */
+        static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        pthread_mutex_lock(&lock);
+
         srand(hash);
         
         double max = RAND_MAX;
@@ -80,6 +90,8 @@ ui_nick_color(char const *nick)
         double s = (rand() / max) * 0.25 + 0.75;
         double l = (rand() / max) * 0.15 + 0.65;
 
+        pthread_mutex_unlock(&lock);
+
         return hsl_to_rgb(h, s, l);
 }
 
@@ -161,7 +173,7 @@ calcwidth(char const *s, int n)
                 break;
         default:
                 --s;
-                char b[16];
+                char b[UTF8_CLUSTER_MAX + 1];
                 int n = utf8_next(s, &w);
                 if (n == 0)
                         n = 1;
@@ -174,9 +186,9 @@ calcwidth(char const *s, int n)
         return width;
 }
 
-/* print with colors and stuff */
+/* print with colors and stuff, in reverse video inside of `hl` */
 static void
-drawtext(char const *s, int n, Video v)
+drawtext(char const *s, int n, Video v, struct re_result const *hl)
 {
 
         char const *end = s + n;
@@ -218,19 +230,22 @@ drawtext(char const *s, int n, Video v)
                 break;
         default:
                 --s;
-                char b[16];
+                char b[UTF8_CLUSTER_MAX + 1];
                 int n = utf8_next(s, &(int){0});
                 if (n == 0)
                         n = 1;
                 memcpy(b, s, n);
                 b[n] = '\0';
-                term_write(&term, v, b);
+                Video cv = v;
+                if (hl != NULL && s >= hl->start && s < hl->end)
+                        cv.reverse = !cv.reverse;
+                term_write(&term, cv, b);
                 s += n;
         }
 }
 
-static void
-sigwinch(int s)
+void
+ui_resize(void)
 {
         struct winsize ws;
         if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != -1) {
@@ -246,7 +261,7 @@ sigwinch(int s)
 }
 
 static int
-draw_message(Window *w, Message *m, int row)
+draw_message(Window *w, Message *m, int row, struct re_result const *hl)
 {
         static vec(int) blocks;
         blocks.count = 0;
@@ -264,6 +279,13 @@ draw_message(Window *w, Message *m, int row)
                         --i;
                 if (i == 0)
                         i = n;
+                if (i == 0) {
+                        /* the window is too narrow for even one character, so take one anyway */
+                        int width;
+                        i = utf8_next(body, &width);
+                        if (i == 0)
+                                i = 1;
+                }
                 body += i;
                 length -= i;
                 vec_push(blocks, i);
@@ -291,9 +313,15 @@ draw_message(Window *w, Message *m, int row)
                         n = sizeof tb - 1;
                 memcpy(tb, m->title, n);
                 tb[n] = '\0';
+                /* the title is drawn from a copy, so move the highlight along with it */
+                struct re_result thl = { NULL, NULL };
+                if (hl != NULL && hl->start >= m->title && hl->start < m->title + n) {
+                        thl.start = tb + (hl->start - m->title);
+                        thl.end = tb + (hl->end - m->title);
+                }
                 while (pad --> 0)
                         term_write(&term, v, " ");
-                drawtext(tb, n, v);
+                drawtext(tb, n, v, &thl);
                 term_write(&term, v, " ");
                 v = V_NORMAL;
         }
@@ -304,7 +332,7 @@ draw_message(Window *w, Message *m, int row)
                 int y = w->y + first_row + i;
                 if (y >= w->y) {
                         term_mvprintf(&term, y, w->x + TIME_LEN + 1 + MAX_NICK + 1, v, "| ");
-                        drawtext(body, n, V_NORMAL);
+                        drawtext(body, n, V_NORMAL, hl);
                 }
                 body += n;
                 if (body[0] == ' ')
@@ -349,180 +377,434 @@ draw_rooms(Eria *state)
         }
 }
 
-static void
-draw_window(Window *w, int *y, int *x)
+/* the contents of an input line, without the separators between characters */
+static char const *
+input_text(Input const *input, size_t *n)
 {
-        switch (w->type) {
-        case W_VS:
-        case W_HS:
-                draw_window(w->one, y, x);
-                draw_window(w->two, y, x);
-                break;
-        default:;
-                Buffer *b = w->buffer;
-                Network *network = b->network;
-                irc *ctx = network->connection;
-                char const *nick = irc_mynick(ctx);
+        static vec(char) ib;
+        ib.count = 0;
 
-                static vec(char) ib;
-                ib.count = 0;
+        for (int i = 0; i < input->data.count; ++i)
+                if (input->data.items[i] != '\0')
+                        vec_push(ib, input->data.items[i]);
+        vec_push(ib, '\0');
 
-                for (int i = 0; i < b->input->data.count; ++i)
-                        if (b->input->data.items[i] != '\0')
-                                vec_push(ib, b->input->data.items[i]);
-                vec_push(ib, '\0');
+        *n = ib.count - 1;
 
-                int row = w->height - 3;
+        return ib.items;
+}
 
-                if (w->nicks && b->type == B_CHANNEL) {
-                        static size_t user_capacity = 0;
-                        static userrep *users = NULL;
+/* the members of a channel, in a buffer that's reused between calls */
+static userrep *
+members(Buffer const *b, int *n)
+{
+        static size_t user_capacity = 0;
+        static userrep *users = NULL;
 
-                        int n_users = irc_num_members(b->network->connection, b->name);
+        *n = irc_num_members(b->network->connection, b->name);
 
-                        if (n_users > user_capacity) {
-                                user_capacity = n_users;
-                                resize(users, user_capacity * sizeof *users);
-                        }
+        if (*n > user_capacity) {
+                user_capacity = *n;
+                resize(users, user_capacity * sizeof *users);
+        }
 
-                        irc_all_members(b->network->connection, b->name, users, user_capacity);
-
-                        int i = n_users - (w->scroll + 1);
-                        char title[64];
-                        char body[256];
-                        Message m = { .title = title, .body = body };
-
-                        while (i >= 0 && row >= 0) {
-                                bool show = !w->search || strstr(users[i].nick, ib.items);
-                                if (show) {
-                                        sprintf(title, "%d", i + 1);
-                                        strcpy(body, users[i].nick);
-                                        row -= draw_message(w, &m, row);
-                                }
-                                i -= 1;
-                        }
-                } else {
-                        int i = b->messages.count - (w->scroll + 1);
-                        while (i >= 0 && row >= 0) {
-                                bool show = !w->search
-                                         || strstr(b->messages.items[i]->body, ib.items)
-                                         || strstr(b->messages.items[i]->title, ib.items);
-                                if (show) {
-                                        row -= draw_message(w, b->messages.items[i], row);
-                                }
-                                i -= 1;
-                        }
-                }
+        irc_all_members(b->network->connection, b->name, users, user_capacity);
 
-                char status[512];
-                switch (b->type) {
-                case B_SERVER:
-                        strcpy(status, irc_myhost(network->connection));
-                        break;
-                case B_CHANNEL:;
-                        int users = irc_num_members(ctx, b->name);
-                        snprintf(status, sizeof status, "%s@%s (%d user%s)", b->name, network->name, users, "s" + (users == 1));
-                        break;
-                case B_USER:
-                        snprintf(status, sizeof status, "%s@%s", b->name, network->name);
-                        break;
-                default:
-                        status[0] = '\0';
+        return users;
+}
+
+inline static uint64_t
+mix(uint64_t h, void const *p, size_t n)
+{
+        unsigned char const *s = p;
+
+        for (size_t i = 0; i < n; ++i)
+                h = (h ^ s[i]) * 1099511628211u;
+
+        return h;
+}
+
+#define MIX(h, x) ((h) = mix((h), &(x), sizeof (x)))
+#define MIX_STR(h, s) ((h) = ((s) == NULL) ? (h) : mix((h), (s), strlen(s) + 1))
+
+/* the lag to show for `network`, in tenths of a second, or 0 */
+static int
+lag(Network const *network)
+{
+        return (network->lag >= LAG_SHOWN) ? network->lag / 100 : 0;
+}
+
+/*
+ * Everything a leaf window's contents depend on, and separately everything
+ * its input line depends on. Messages are only ever appended, so their count
+ * stands in for the messages themselves.
+ */
+static uint64_t
+signature(Window const *w, bool focused, uint64_t *line)
+{
+        uint64_t h = 14695981039346656037u;
+        Buffer const *b = w->buffer;
+        Network const *network = b->network;
+        Input const *input = b->input;
+
+        MIX(h, w->y);
+        MIX(h, w->x);
+        MIX(h, w->height);
+        MIX(h, w->width);
+
+        uint64_t l = h;
+        MIX(l, input->cursor);
+        l = mix(l, input->data.items, input->data.count);
+        MIX_STR(l, irc_mynick(network->connection));
+        *line = l;
+
+        /* the input line is the query, so it decides what the window shows */
+        if (w->search || w->global)
+                h = l;
+
+        MIX(h, w->scroll);
+        MIX(h, w->resize);
+        MIX(h, w->search);
+        MIX(h, w->nicks);
+        MIX(h, w->global);
+        MIX(h, focused);
+        MIX(h, b);
+        MIX(h, b->messages.count);
+        MIX_STR(h, network->name);
+        int shown_lag = lag(network);
+        MIX(h, shown_lag);
+        MIX(h, network->status);
+
+        if (b->type == B_SERVER)
+                MIX_STR(h, irc_myhost(network->connection));
+
+        if (b->type == B_CHANNEL) {
+                int n = irc_num_members(network->connection, b->name);
+                MIX(h, n);
+                if (w->nicks) {
+                        userrep *users = members(b, &n);
+                        for (int i = 0; i < n; ++i)
+                                MIX_STR(h, users[i].nick);
                 }
+        }
+
+        if (w->global) {
+                size_t count;
+                Result const *rs = gsearch_results(&count);
+                bool busy = gsearch_busy();
+                MIX(h, count);
+                MIX(h, busy);
+                for (size_t i = w->scroll; i < count && i < w->scroll + w->height; ++i)
+                        MIX(h, rs[i].message);
+        }
+
+        return h;
+}
+
+/* the prompt and input line along the bottom of a window */
+static void
+draw_input(Window *w, int *y, int *x)
+{
+        Buffer *b = w->buffer;
+        char const *nick = irc_mynick(b->network->connection);
 
-                if (w->scroll > 0)
-                        strcat(status, " (scroll)");
+        static vec(char) input;
+        input.count = 0;
+        int cursor = 0;
 
-                if (w->resize)
-                        strcat(status, " (resize)");
+        Video v = V_NORMAL;
 
-                if (w->search)
-                        strcat(status, " (search)");
+        term_mvprintf(&term, w->y + w->height - 1, w->x, v, "(%s) ", nick);
 
-                if (w->nicks)
-                        strcat(status, " (nicks)");
+        if (b->input->data.count != 0) {
+                for (int i = 0; i < b->input->data.count; ++i) {
+                        if (b->input->data.items[i] != '\0')
+                                vec_push(input, b->input->data.items[i]);
+                        if (i + 1 == b->input->cursor)
+                                cursor = input.count;
+                }
 
-                int n = strlen(status);
-                int width = utf8_width(status, n);
-                while (width++ < w->width)
-                        status[n++] = ' ';
-                status[n] = '\0';
+                vec_push(input, '\0');
 
-                Video v = V_NORMAL;
-                v.fg = (Color) { 235, 235, 235 };
-                v.bg = (Color) { 45, 45, 45    };
+                char *s = input.items;
+                int cx = utf8_width(s, cursor);
+                int prompt_width = utf8_width(nick, strlen(nick)) + 3;
+                int space = w->width - prompt_width;
+                int step = space / 2;
 
-                term_move(&term, w->y + w->height - 2, w->x);
-                term_write(&term, v, status);
+                int offset = 0;
+                while (cx - offset >= space)
+                        offset += step;
 
-                static vec(char) input;
-                input.count = 0;
-                int cursor = 0;
 
-                v = V_NORMAL;
+                s += utf8_fit(s, strlen(s), offset);
+                s[utf8_fit(s, strlen(s), space)] = '\0';
 
-                term_mvprintf(&term, w->y + w->height - 1, w->x, v, "(%s) ", nick);
+                term_write(&term, v, s);
+
+                *y = w->y + w->height - 1;
+                *x = w->x + prompt_width + cx - offset;
+        } else {
+                *y = w->y + w->height - 1;
+                *x = w->x + strlen(nick) + 3;
+        }
+}
 
-                if (b->input->data.count != 0) {
-                        for (int i = 0; i < b->input->data.count; ++i) {
-                                if (b->input->data.items[i] != '\0')
-                                        vec_push(input, b->input->data.items[i]);
-                                if (i + 1 == b->input->cursor)
-                                        cursor = input.count;
+static void
+draw_leaf(Window *w, int *y, int *x)
+{
+        Buffer *b = w->buffer;
+        Network *network = b->network;
+        irc *ctx = network->connection;
+
+        size_t qn;
+        char const *query = input_text(b->input, &qn);
+
+        /* only recompiles when the query text actually changed */
+        if (w->search)
+                query_set(&w->query, query, qn);
+
+        struct re_result hl = { NULL, NULL };
+
+        int row = w->height - 3;
+
+        if (w->global) {
+                size_t count;
+                Result const *rs = gsearch_results(&count);
+                Query const *q = gsearch_query();
+
+                static vec(char) body;
+                size_t i = w->scroll;
+
+                /* newest result at the bottom, each titled with the buffer it came from */
+                while (i < count && row >= 0) {
+                        Message const *r = rs[i].message;
+                        body.count = 0;
+                        vec_push_n(body, r->title, strlen(r->title));
+                        vec_push(body, ' ');
+                        vec_push_n(body, r->body, strlen(r->body) + 1);
+                        Message m = {
+                                .important = r->important,
+                                .time = r->time,
+                                .title = rs[i].buffer->name,
+                                .body = body.items
+                        };
+                        bool match = (q != NULL) && query_match(q, m.body, &hl);
+                        row -= draw_message(w, &m, row, match ? &hl : NULL);
+                        i += 1;
+                }
+        } else if (w->nicks && b->type == B_CHANNEL) {
+                int n_users;
+                userrep *users = members(b, &n_users);
+
+                int i = n_users - (w->scroll + 1);
+                char title[64];
+                char body[256];
+                Message m = { .title = title, .body = body };
+
+                while (i >= 0 && row >= 0) {
+                        snprintf(body, sizeof body, "%s", users[i].nick);
+                        bool show = !w->search || query_match(&w->query, body, &hl);
+                        if (show) {
+                                sprintf(title, "%d", i + 1);
+                                row -= draw_message(w, &m, row, w->search ? &hl : NULL);
+                        }
+                        i -= 1;
+                }
+        } else if (w->search && w->query.fuzzy) {
+                /* fuzzy results are ranked rather than filtered: best match at the bottom */
+                query_rank(&w->query, b, b->messages.items, b->messages.count);
+
+                size_t i = w->scroll;
+                while (i < w->query.ranked && row >= 0) {
+                        Message *m = b->messages.items[query_hit(&w->query, i)];
+                        if (query_distance(&w->query, m->body, &hl) == -1)
+                                query_distance(&w->query, m->title, &hl);
+                        row -= draw_message(w, m, row, &hl);
+                        i += 1;
+                }
+        } else {
+                int i = b->messages.count - (w->scroll + 1);
+                while (i >= 0 && row >= 0) {
+                        Message *m = b->messages.items[i];
+                        bool show = !w->search
+                                 || query_match(&w->query, m->body, &hl)
+                                 || query_match(&w->query, m->title, &hl);
+                        if (show) {
+                                row -= draw_message(w, m, row, w->search ? &hl : NULL);
                         }
+                        i -= 1;
+                }
+        }
+
+        char status[512];
+        switch (b->type) {
+        case B_SERVER:
+                strcpy(status, irc_myhost(network->connection));
+                break;
+        case B_CHANNEL:;
+                int users = irc_num_members(ctx, b->name);
+                snprintf(status, sizeof status, "%s@%s (%d user%s)", b->name, network->name, users, "s" + (users == 1));
+                break;
+        case B_USER:
+                snprintf(status, sizeof status, "%s@%s", b->name, network->name);
+                break;
+        default:
+                status[0] = '\0';
+        }
 
-                        vec_push(input, '\0');
+        if (w->global) {
+                size_t count;
+                gsearch_results(&count);
+                snprintf(status, sizeof status, "global search: %zu result%s", count, "s" + (count == 1));
+                if (gsearch_busy())
+                        strcat(status, " (searching)");
+        }
+
+        if (lag(network) != 0) {
+                size_t n = strlen(status);
+                snprintf(status + n, sizeof status - n, " (lag %d.%ds)", lag(network) / 10, lag(network) % 10);
+        }
+
+        if (network->status == NET_CONNECTING)
+                strcat(status, " (connecting)");
+        else if (network->status == NET_OFFLINE)
+                strcat(status, " (offline)");
 
-                        char *s = input.items;
-                        int cx = utf8_width(s, cursor);
-                        int prompt_width = utf8_width(nick, strlen(nick)) + 3;
-                        int space = w->width - prompt_width;
-                        int step = space / 2;
+        if (w->scroll > 0)
+                strcat(status, " (scroll)");
 
-                        int offset = 0;
-                        while (cx - offset >= space)
-                                offset += step;
+        if (w->resize)
+                strcat(status, " (resize)");
 
+        if (w->search)
+                strcat(status, w->query.bad ? " (search: bad regex)" : " (search)");
 
-                        s += utf8_fit(s, strlen(s), offset);
-                        s[utf8_fit(s, strlen(s), space)] = '\0';
+        if (w->nicks)
+                strcat(status, " (nicks)");
 
-                        term_write(&term, v, s);
+        int n = strlen(status);
+        int width = utf8_width(status, n);
+        while (width++ < w->width)
+                status[n++] = ' ';
+        status[n] = '\0';
 
-                        *y = w->y + w->height - 1;
-                        *x = w->x + prompt_width + cx - offset;
+        Video v = V_NORMAL;
+        v.fg = (Color) { 235, 235, 235 };
+        v.bg = (Color) { 45, 45, 45    };
+
+        term_move(&term, w->y + w->height - 2, w->x);
+        term_write(&term, v, status);
+
+        draw_input(w, y, x);
+}
+
+/*
+ * Draws the leaves whose signature changed since they were last drawn, or
+ * all of them. When only a window's input line changed, only that row is
+ * redrawn, which is what typing usually amounts to. The cursor goes
+ * wherever the focused window last put it.
+ */
+static void
+draw_window(Window *w, Window *focus, bool all, int *y, int *x)
+{
+        static int cy, cx;
+
+        switch (w->type) {
+        case W_VS:
+        case W_HS:
+                draw_window(w->one, focus, all, y, x);
+                draw_window(w->two, focus, all, y, x);
+                break;
+        default:;
+                uint64_t line;
+                uint64_t sig = signature(w, w == focus, &line);
+                int wy = cy, wx = cx;
+
+                if (all || sig != w->drawn) {
+                        if (!all)
+                                term_erase(&term, w->y, w->x, w->height, w->width);
+                        term_clip(&term, w->y, w->x, w->height, w->width);
+                        draw_leaf(w, &wy, &wx);
+                } else if (line != w->drawn_line) {
+                        int row = w->y + w->height - 1;
+                        term_erase(&term, row, w->x, 1, w->width);
+                        term_clip(&term, row, w->x, 1, w->width);
+                        draw_input(w, &wy, &wx);
                 } else {
-                        *y = w->y + w->height - 1;
-                        *x = w->x + strlen(nick) + 3;
+                        break;
+                }
+
+                if (w == focus) {
+                        cy = wy;
+                        cx = wx;
                 }
+
+                w->drawn = sig;
+                w->drawn_line = line;
         }
+
+        *y = cy;
+        *x = cx;
 }
 
-void
+bool
 ui_draw(Eria *state)
 {
-        term_clear(&term);
+        /*
+         * The terminal hasn't kept up, so skip this frame. Once it has caught
+         * up, the next call draws whatever is current by then.
+         */
+        if (term_busy(&term))
+                return false;
+
+        if (state->window->global) {
+                size_t n;
+                char const *query = input_text(state->window->buffer->input, &n);
+                gsearch_update(state, query, n);
+        }
+
+        /* the room list is drawn over the windows, so it comes and goes with a full redraw */
+        static bool rooms;
+        bool all = term.force || rooms || state->draw_rooms;
+        rooms = state->draw_rooms;
+
+        if (all)
+                term_clear(&term);
 
         int y, x;
-        draw_window(state->root, &y, &x);
-        draw_window(state->window, &y, &x);
+        draw_window(state->root, state->window, all, &y, &x);
+        term_clip(&term, 0, 0, term.rows, term.cols);
 
         if (state->draw_rooms)
                 draw_rooms(state);
 
         term_move(&term, y, x);
         term_flush(&term);
+
+        return true;
+}
+
+static void
+set_colors(Config const *config)
+{
+        switch (config->colors) {
+        case 0:   term.colors = term_guess_colors(); break;
+        case 16:  term.colors = TC_16;               break;
+        case 256: term.colors = TC_256;              break;
+        default:  term.colors = TC_TRUE;             break;
+        }
 }
 
 void
 ui_init(Eria *state)
 {
-        sigwinch(SIGWINCH);
-        struct sigaction const sa = { .sa_handler = sigwinch };
-        sigaction(SIGWINCH, &sa, NULL);
+        ui_resize();
 
         root = state->root = window_root(term.rows, term.cols);
 
+        set_colors(state->config);
+
         struct termios tp;
         tcgetattr(STDIN_FILENO, &tp);
         tp.c_lflag &= ~ECHO;
@@ -533,12 +815,48 @@ ui_init(Eria *state)
         write(STDOUT_FILENO, s, sizeof s - 1);
 }
 
+void
+ui_init_sink(Eria *state, int rows, int cols, TermSink *sink, void *ctx)
+{
+        term.sink = sink;
+        term.sink_ctx = ctx;
+        term_resize(&term, rows, cols);
+        term.force = true;
+
+        root = state->root = window_root(rows, cols);
+
+        set_colors(state->config);
+}
+
 void
 ui_cleanup(void)
 {
+        /* stdout may be non-blocking, but here we have to wait for it */
+        struct pollfd out = { .fd = STDOUT_FILENO, .events = POLLOUT };
+
+        while (!term_drain(&term))
+                poll(&out, 1, -1);
+
         /* take the terminal out of alternate screen mode */
         char s[] = "\033[?1049l";
-        write(STDOUT_FILENO, s, sizeof s - 1);
+        while (write(STDOUT_FILENO, s, sizeof s - 1) == -1 && (errno == EAGAIN || errno == EINTR))
+                poll(&out, 1, -1);
+
         term_clear(&term);
         term_flush(&term);
+
+        while (!term_drain(&term))
+                poll(&out, 1, -1);
+}
+
+int
+ui_output_fd(void)
+{
+        return term_busy(&term) ? STDOUT_FILENO : -1;
+}
+
+void
+ui_drain(void)
+{
+        term_drain(&term);
 }
@@ -0,0 +1,78 @@
+/*
+ * A small LRU cache of emoji clusters. A cluster that starts with an emoji
+ * or a regional indicator can only take in other non-ASCII characters, so
+ * the run of non-ASCII bytes it starts is all that its length and width
+ * depend on, and that's the key.
+ *
+ * Only the UI draws text, so there's one cache and no locking.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "utf8.h"
+
+#define SETS 64
+#define WAYS 4
+
+typedef struct {
+        uint32_t used; /* when it was last hit, 0 if it's empty */
+        uint32_t hash;
+        uint8_t size; /* of the key */
+        uint8_t length;
+        uint8_t width;
+        char key[UTF8_CLUSTER_MAX];
+} Entry;
+
+static Entry cache[SETS][WAYS];
+static uint32_t tick;
+
+int
+utf8_emoji(char const *str, int len, int *width)
+{
+        int size = 0;
+        uint32_t hash = 2166136261u;
+
+        if (len > UTF8_CLUSTER_MAX)
+                len = UTF8_CLUSTER_MAX;
+
+        for (; size < len && (unsigned char)str[size] >= 0x80; ++size) {
+                hash ^= (unsigned char)str[size];
+                hash *= 16777619u;
+        }
+
+        Entry *set = cache[hash % SETS];
+        Entry *lru = &set[0];
+
+        /* rather than wrap, start everything over */
+        if (++tick == 0) {
+                memset(cache, 0, sizeof cache);
+                tick = 1;
+        }
+
+        for (int i = 0; i < WAYS; ++i) {
+                Entry *e = &set[i];
+
+                if (e->used != 0 && e->hash == hash && e->size == size && memcmp(e->key, str, size) == 0) {
+                        e->used = tick;
+                        *width = e->width;
+                        return e->length;
+                }
+
+                if (e->used < lru->used)
+                        lru = e;
+        }
+
+        int w;
+        int n = utf8_segment(str, size, &w);
+
+        lru->used = tick;
+        lru->hash = hash;
+        lru->size = size;
+        lru->length = n;
+        lru->width = w;
+        memcpy(lru->key, str, size);
+
+        *width = w;
+        return n;
+}
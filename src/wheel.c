@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "wheel.h"
+
+#define MASK (WHEEL_SLOTS - 1)
+
+/* how far ahead the top level reaches */
+#define SPAN ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+/* the bits of `x` rotated right by `n`, which is less than 64 */
+inline static uint64_t
+rotr(uint64_t x, unsigned n)
+{
+        return (n == 0) ? x : (x >> n) | (x << (64 - n));
+}
+
+/* put `t` where it belongs relative to w->now, which is no later than t->expires */
+static void
+place(Wheel *w, WheelTimer *t)
+{
+        uint64_t expires = t->expires;
+        uint64_t d = expires - w->now;
+        int level = 0;
+
+        /* too far off for the top level: park it in the last slot there and look again then */
+        if (d >= SPAN) {
+                expires = w->now + SPAN - 1;
+                d = SPAN - 1;
+        }
+
+        while (level < WHEEL_LEVELS - 1 && d >= (uint64_t)1 << (WHEEL_BITS * (level + 1)))
+                ++level;
+
+        int slot = (expires >> (WHEEL_BITS * level)) & MASK;
+        WheelTimer **head = &w->slots[level][slot];
+
+        t->level = level;
+        t->slot = slot;
+        t->next = *head;
+        t->pprev = head;
+        if (*head != NULL)
+                (*head)->pprev = &t->next;
+        *head = t;
+
+        w->occupied[level] |= (uint64_t)1 << slot;
+}
+
+static void
+detach(Wheel *w, WheelTimer *t)
+{
+        *t->pprev = t->next;
+        if (t->next != NULL)
+                t->next->pprev = t->pprev;
+
+        if (w->slots[t->level][t->slot] == NULL)
+                w->occupied[t->level] &= ~((uint64_t)1 << t->slot);
+
+        t->next = NULL;
+        t->pprev = NULL;
+}
+
+void
+wheel_init(Wheel *w, uint64_t now)
+{
+        memset(w, 0, sizeof *w);
+        w->now = now;
+}
+
+void
+wheel_add(Wheel *w, WheelTimer *t, uint64_t expires)
+{
+        if (wheel_pending(t))
+                detach(w, t);
+
+        /* the slot for w->now has already been emptied */
+        t->expires = (expires > w->now) ? expires : w->now + 1;
+
+        place(w, t);
+}
+
+void
+wheel_cancel(Wheel *w, WheelTimer *t)
+{
+        if (wheel_pending(t))
+                detach(w, t);
+}
+
+int64_t
+wheel_next(Wheel const *w)
+{
+        int64_t next = -1;
+
+        for (int level = 0; level < WHEEL_LEVELS; ++level) {
+                if (w->occupied[level] == 0)
+                        continue;
+
+                /* the nearest slot after the current one, going round if need be */
+                unsigned shift = WHEEL_BITS * level;
+                unsigned current = (w->now >> shift) & MASK;
+                uint64_t k = __builtin_ctzll(rotr(w->occupied[level], (current + 1) & MASK)) + 1;
+
+                /* a level 0 slot is when its timers expire, a higher one when they move down */
+                int64_t when = (int64_t)(((w->now >> shift) + k) << shift);
+
+                if (next == -1 || when < next)
+                        next = when;
+        }
+
+        return next;
+}
+
+void
+wheel_advance(Wheel *w, uint64_t now)
+{
+        while (w->now < now) {
+                int64_t next = wheel_next(w);
+
+                /* nothing happens in between, so there's no need to go through it */
+                if (next == -1 || (uint64_t)next > now) {
+                        w->now = now;
+                        break;
+                }
+
+                w->now = next;
+
+                /* top down, so what comes down from one level is redistributed by the next */
+                for (int level = WHEEL_LEVELS - 1; level > 0; --level) {
+                        unsigned shift = WHEEL_BITS * level;
+                        if ((w->now & (((uint64_t)1 << shift) - 1)) != 0)
+                                continue;
+
+                        WheelTimer **head = &w->slots[level][(w->now >> shift) & MASK];
+                        while (*head != NULL) {
+                                WheelTimer *t = *head;
+                                detach(w, t);
+                                place(w, t);
+                        }
+                }
+
+                /* a handler may add or cancel timers, so take them off one at a time */
+                WheelTimer **head = &w->slots[0][w->now & MASK];
+                while (*head != NULL) {
+                        WheelTimer *t = *head;
+                        detach(w, t);
+                        t->fn(t->ctx);
+                }
+        }
+}
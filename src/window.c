@@ -27,6 +27,10 @@ new(Window *parent, int height, int width, int y, int x)
         w->resize = false;
         w->search = false;
         w->nicks = false;
+        w->global = false;
+        w->drawn = 0;
+        w->drawn_line = 0;
+        query_init(&w->query);
 
         return w;
 }
@@ -286,6 +290,9 @@ window_hsplit(Window *w, Buffer *b, int size)
         Buffer *old = w->buffer;
         int scroll = w->scroll;
         bool resize = w->resize;
+        bool search = w->search;
+        bool global = w->global;
+        Query query = w->query;
 
         w->type = W_HS;
         w->top = new(w, th, w->width, w->y, w->x);
@@ -294,6 +301,10 @@ window_hsplit(Window *w, Buffer *b, int size)
         w->top->scroll = scroll;
         w->top->buffer = old;
         w->top->resize = resize;
+        w->top->search = search;
+        w->top->global = global;
+        query_free(&w->top->query);
+        w->top->query = query;
         w->bot->buffer = b;
 }
 
@@ -306,12 +317,19 @@ window_vsplit(Window *w, Buffer *b, int size)
         int lw = w->width - rw;
 
         Buffer *old = w->buffer;
+        bool search = w->search;
+        bool global = w->global;
+        Query query = w->query;
 
         w->type = W_VS;
         w->left = new(w, w->height, lw, w->y, w->x);
         w->right = new(w, w->height, rw, w->y, w->x + lw);
 
         w->left->buffer = old;
+        w->left->search = search;
+        w->left->global = global;
+        query_free(&w->left->query);
+        w->left->query = query;
         w->right->buffer = b;
 }
 
@@ -337,6 +355,12 @@ window_delete(Window *w)
                 parent->buffer = sibling->buffer;
                 parent->scroll = sibling->scroll;
                 parent->resize = sibling->resize;
+                parent->search = sibling->search;
+                parent->nicks = sibling->nicks;
+                parent->global = sibling->global;
+                parent->query = sibling->query;
+                parent->drawn = 0;
+                parent->drawn_line = 0;
         } else {
                 parent->one = sibling->one;
                 parent->two = sibling->two;
@@ -345,6 +369,8 @@ window_delete(Window *w)
                 fix(parent);
         }
 
+        query_free(&w->query);
+
         free(sibling);
         free(w);
 